@@ -34,6 +34,72 @@ void _ClearHashTable(GifHashTableType *HashTable);
 void _InsertHashTable(GifHashTableType *HashTable, uint32_t Key, int Code);
 int _ExistsHashTable(GifHashTableType *HashTable, uint32_t Key);
 
+/* Dictionary used by the encoder. For small pixels (palettes of at most  */
+/* 2^CT_MAX_DIRECT_BITS colors) it is a direct table: one row per prefix   */
+/* code, one entry per pixel value, holding the code of the string and the */
+/* generation it was added in, so clearing it only starts a generation.    */
+/* Bigger pixels use the hash table above: the rows would not fit in cache.*/
+#define CT_MAX_DIRECT_BITS	4
+#define CT_MAX_GEN		0xFFFFF	/* Generation in the upper 20 bits. */
+#define CT_GET_GEN(l)	(l >> 12)
+#define CT_GET_CODE(l)	(l & 0x0FFF)
+#define CT_PUT(gen, code)	(((gen) << 12) | ((code) & 0x0FFF))
+
+typedef struct GifCodeTableType {
+    uint32_t *Entries;	/* (HT_MAX_CODE + 1) << PixelBits entries. */
+    int PixelBits;	/* Bits of a pixel the entries are allocated for. */
+    int RowBits;	/* Bits of a pixel now, 0 when hashing. */
+    uint32_t Generation;
+    GifHashTableType *HashTable;
+    /* Strings made of one pixel repeated n times ("runs"): */
+    uint16_t RunLength[HT_MAX_CODE + 1];	/* n for a run code, else 0. */
+    uint8_t RunPixel[HT_MAX_CODE + 1];	/* Pixel of a run code. */
+    uint16_t RunCount[256];	/* Longest run known for each pixel. */
+    uint16_t *RunCodes;		/* Code of run n of pixel p: [(p << 12) + n]. */
+    int RunBits;		/* Bits of a pixel RunCodes is allocated for. */
+} GifCodeTableType;
+
+#define CT_RUN_CODE(t, p, n)	((t)->RunCodes[((p) << 12) + (n)])
+
+GifCodeTableType *_InitCodeTable(void);
+int _ClearCodeTable(GifCodeTableType *CodeTable, int PixelBits);
+void _FreeCodeTable(GifCodeTableType *CodeTable);
+
+/* Code of the string Prefix followed by Pixel, -1 if it is not known yet. */
+static inline int _ExistsCodeTable(const GifCodeTableType *CodeTable,
+				   int Prefix, int Pixel)
+{
+    uint32_t Entry;
+
+    if (CodeTable->RowBits == 0)
+	return _ExistsHashTable(CodeTable->HashTable,
+				((uint32_t) Prefix << 8) + Pixel);
+
+    Entry = CodeTable->Entries[((uint32_t) Prefix << CodeTable->RowBits) + Pixel];
+    return CT_GET_GEN(Entry) == CodeTable->Generation ? (int) CT_GET_CODE(Entry) : -1;
+}
+
+static inline void _InsertCodeTable(GifCodeTableType *CodeTable,
+				    int Prefix, int Pixel, int Code)
+{
+    /* Runs of a pixel are added in order, the longest one being the prefix */
+    if (CodeTable->RunLength[Prefix] != 0 && CodeTable->RunPixel[Prefix] == Pixel) {
+	int n = CodeTable->RunLength[Prefix] + 1;
+	CodeTable->RunLength[Code] = n;
+	CodeTable->RunPixel[Code] = Pixel;
+	CodeTable->RunCount[Pixel] = n;
+	CT_RUN_CODE(CodeTable, Pixel, n) = Code;
+    } else
+	CodeTable->RunLength[Code] = 0;
+
+    if (CodeTable->RowBits == 0)
+	_InsertHashTable(CodeTable->HashTable,
+			 ((uint32_t) Prefix << 8) + Pixel, Code);
+    else
+	CodeTable->Entries[((uint32_t) Prefix << CodeTable->RowBits) + Pixel] =
+	    CT_PUT(CodeTable->Generation, (uint32_t) Code);
+}
+
 #endif /* _GIF_HASH_H_ */
 
 /* end */
@@ -68,6 +68,16 @@ typedef struct SavedImage {
     ExtensionBlock *ExtensionBlocks; /* Extensions before image */    
 } SavedImage;
 
+/* Where to find one image of a GIF file again, filled by DGifScanFrames() */
+typedef struct GifFrameIndex {
+    long DescOffset;                 /* File offset of the image descriptor */
+    long DataOffset;                 /* File offset of the LZW code size byte */
+    int CodeSize;                    /* LZW minimum code size */
+    GifWord Left, Top, Width, Height;
+    int Interlace;
+    int HasColorMap;                 /* Image has a local colormap */
+} GifFrameIndex;
+
 typedef struct GifFileType {
     GifWord SWidth, SHeight;         /* Size of virtual canvas */
     GifWord SColorResolution;        /* How many colors can we generate? */
@@ -128,6 +138,17 @@ GifFileType *EGifOpenFileName(const char *GifFileName,
 GifFileType *EGifOpenFileHandle(const int GifFileHandle, int *Error);
 GifFileType *EGifOpen(void *userPtr, OutputFunc writeFunc, int *Error);
 int EGifSpew(GifFileType * GifFile);
+int EGifEncodeImage(const ColorMapObject *ColorMap,
+                    const int Width, const int Height, const bool Interlace,
+                    const bool Literal,
+                    GifPixelType *RasterBits,
+                    GifByteType **Buffer, size_t *Length, int *Error);
+int EGifSpewEncoded(GifFileType * GifFile, GifByteType **ImageData,
+                    const size_t *ImageDataLength);
+int EGifPutEncodedImage(GifFileType * GifFile, const SavedImage *Image,
+                        const GifByteType *ImageData,
+                        const size_t ImageDataLength);
+int EGifSpewClose(GifFileType * GifFile);
 const char *EGifGetGifVersion(GifFileType *GifFile); /* new in 5.x */
 int EGifCloseFile(GifFileType *GifFile, int *ErrorCode);
 
@@ -155,6 +176,7 @@ int EGifPutImageDesc(GifFileType *GifFile,
 		     const bool GifInterlace,
                      const ColorMapObject *GifColorMap);
 void EGifSetGifVersion(GifFileType *GifFile, const bool gif89);
+void EGifSetLiteralCodes(GifFileType *GifFile, const bool Literal);
 int EGifPutLine(GifFileType *GifFile, GifPixelType *GifLine,
                 int GifLineLen);
 int EGifPutPixel(GifFileType *GifFile, const GifPixelType GifPixel);
@@ -178,7 +200,12 @@ int EGifPutCodeNext(GifFileType *GifFile,
 /* Main entry points */
 GifFileType *DGifOpenFileName(const char *GifFileName, int *Error);
 GifFileType *DGifOpenFileHandle(int GifFileHandle, int *Error);
+GifFileType *DGifOpenMemory(const GifByteType *Data, size_t Size, int *Error);
+GifFileType *DGifOpenFileMapped(const char *GifFileName, int *Error);
 int DGifSlurp(GifFileType * GifFile);
+int DGifScanFrames(GifFileType * GifFile, GifFrameIndex **Index);
+int DGifDecodeFrame(GifFileType * GifFile, const GifFrameIndex *Frame,
+                    GifPixelType *RasterBits);
 GifFileType *DGifOpen(void *userPtr, InputFunc readFunc, int *Error);    /* new one (TVT) */
     int DGifCloseFile(GifFileType * GifFile, int *ErrorCode);
 
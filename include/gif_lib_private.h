@@ -21,6 +21,10 @@ gif_lib_private.h - internal giflib routines and structures
 #define FIRST_CODE          4097    /* Impossible code, to signal first. */
 #define NO_SUCH_CODE        4098    /* Impossible code, to signal empty. */
 
+#define PACKED_BLOCKS       64      /* Data blocks packed before a write. */
+#define PACKED_BUF_SIZE     (PACKED_BLOCKS * 255 + 8)
+#define BLOCK_BUF_SIZE      ((PACKED_BLOCKS + 1) * 256 + 1)
+
 #define FILE_STATE_WRITE    0x01
 #define FILE_STATE_SCREEN   0x02
 #define FILE_STATE_IMAGE    0x04
@@ -29,6 +33,21 @@ gif_lib_private.h - internal giflib routines and structures
 #define IS_READABLE(Private)    (Private->FileState & FILE_STATE_READ)
 #define IS_WRITEABLE(Private)   (Private->FileState & FILE_STATE_WRITE)
 
+/* Input of DGifOpenMemory() and DGifOpenFileMapped(): */
+typedef struct GifMemoryInput {
+    const GifByteType *Data;
+    size_t Size,
+      Pos;     /* Next byte to read, like a file position. */
+    bool Mapped;    /* Data was mapped by DGifOpenFileMapped(). */
+} GifMemoryInput;
+
+/* Chunk of an arena (see GifArenaAlloc()), its Size bytes follow it: */
+typedef struct GifArenaChunk {
+    struct GifArenaChunk *Next;    /* Chunk allocated before this one. */
+    size_t Size,
+      Used;    /* Bytes already allocated. */
+} GifArenaChunk;
+
 typedef struct GifFilePrivateType {
     GifWord FileState, FileHandle,  /* Where all this data goes to! */
       BitsPerPixel,     /* Bits per pixel (Codes uses at least this + 1). */
@@ -41,7 +60,7 @@ typedef struct GifFilePrivateType {
       CrntCode,    /* Current algorithm code. */
       StackPtr,    /* For character stack (see below). */
       CrntShiftState;    /* Number of bits in CrntShiftDWord. */
-    unsigned long CrntShiftDWord;   /* For bytes decomposition into codes. */
+    uint64_t CrntShiftDWord;   /* For bytes decomposition into codes. */
     unsigned long PixelCount;   /* Number of pixels in image. */
     FILE *File;    /* File as stream. */
     InputFunc Read;     /* function to read gif input (TVT) */
@@ -50,10 +69,31 @@ typedef struct GifFilePrivateType {
     GifByteType Stack[LZ_MAX_CODE]; /* Decoded pixels are stacked here. */
     GifByteType Suffix[LZ_MAX_CODE + 1];    /* So we can trace the codes. */
     GifPrefixType Prefix[LZ_MAX_CODE + 1];
-    GifHashTableType *HashTable;
+    GifPrefixType Length[LZ_MAX_CODE + 1];  /* Length of the string of each code. */
+    GifByteType FirstChar[LZ_MAX_CODE + 1]; /* First pixel of each code. */
+    GifCodeTableType *CodeTable;
+    int PackedLen;    /* Number of bytes in PackedBuf. */
+    GifByteType PackedBuf[PACKED_BUF_SIZE]; /* Codes packed, not in blocks yet. */
+    GifByteType BlockBuf[BLOCK_BUF_SIZE];   /* Data blocks, written at once. */
     bool gif89;
+    GifMemoryInput *Memory;    /* Input in memory, NULL when read otherwise. */
+    const GifByteType *BlockPtr;    /* Data block read from Memory, */
+    int BlockLeft;                  /* and its number of bytes left. */
+    bool LiteralCodes;    /* Write every pixel as a literal code (no LZW). */
+    int LiteralCount;     /* Literal codes since the last clear code. */
+    GifArenaChunk *Arena; /* Extension blocks read, all freed at close. */
 } GifFilePrivateType;
 
+extern void *GifGrowArray(void *Array, int Count, size_t Size);
+extern void *GifArenaAlloc(GifArenaChunk **Arena, size_t Size, size_t Align);
+extern void GifArenaFree(GifArenaChunk **Arena);
+extern int GifArenaAddExtensionBlock(GifArenaChunk **Arena,
+                                     int *ExtensionBlockCount,
+                                     ExtensionBlock **ExtensionBlocks,
+                                     int Function,
+                                     unsigned int Len,
+                                     unsigned char ExtData[]);
+
 #endif /* _GIF_LIB_PRIVATE_H */
 
 /* end */
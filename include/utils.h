@@ -17,12 +17,64 @@ typedef struct animated_gif
     int * width ; /* Width of each image */
     int * height ; /* Height of each image */
     pixel ** p ; /* Pixels of each image */
+    unsigned char ** mask ; /* Transparent pixels of each image (see load_transparent_pixels), NULL if not kept */
     GifFileType * g ; /* Internal representation. DO NOT MODIFY */
 } animated_gif ;
 
+/* Output written frame by frame (see open_gif_writer) */
+typedef struct gif_writer
+{
+    GifFileType * g ; /* Output file */
+    animated_gif * image ; /* Frames to write */
+    ColorMapObject * cmo ; /* Global colormap, every gray level */
+    GifByteType gray_index[256] ; /* Index of each gray level in cmo */
+    char * done ; /* Frames filtered, written or waiting for the ones before */
+    int * dup ; /* First copy of each frame (see find_duplicate_frames), NULL if none */
+    int * last ; /* Last copy of each first copy, NULL if dup is */
+    int * unique ; /* Frame of each index given to write_gif_frame, NULL if the same */
+    int next ; /* First frame not written yet */
+    int first ; /* Frame given to write_gif_frame as 0 (first frame of the window being filtered) */
+    int literal ; /* 1 to store the pixels as literal codes */
+} gif_writer ;
+
+/* Previous frame filtered, to filter again only what changed (see apply_filters_one_frame_cached) */
+typedef struct filter_cache
+{
+    int width, height ; /* Size of the frame cached */
+    pixel * input ; /* Its pixels before filtering, NULL if there is none */
+    pixel * output ; /* and after */
+    int n_iter ; /* Blur iterations it needed */
+    unsigned char * active ; /* For each iteration, the tiles with pixels not converged yet */
+    int max_iter ; /* Iterations allocated in active */
+} filter_cache ;
+
 animated_gif *load_pixels( char * filename );
-int output_modified_read_gif( char * filename, GifFileType * g ) ;
-int store_pixels( char * filename, animated_gif * image );
+animated_gif *load_transparent_pixels( char * filename );
+animated_gif *scan_pixels( char * filename, GifFrameIndex ** index );
+animated_gif *scan_pixels_unmapped( char * filename, GifFrameIndex ** index );
+int alloc_pixels( animated_gif * image, int first, int n );
+int decode_pixels( GifFileType * g, GifFrameIndex * frame, pixel * p );
+int decode_next_pixels( GifFileType * g, pixel * p );
+animated_gif *load_composited_pixels( char * filename );
+int * find_duplicate_frames( animated_gif * image, int * n_unique );
+int output_modified_read_gif( char * filename, GifFileType * g, int literal ) ;
+int init_output_colormap( animated_gif * image, GifColorType * colormap );
+unsigned short * new_color_lut( void );
+void clear_color_lut( unsigned short * lut, GifColorType * colormap, int n_colors );
+int add_pixel_colors( GifColorType * colormap, int n_colors, pixel * p, int n_pixels,
+        unsigned short * lut );
+ColorMapObject * make_output_colormap( GifColorType * colormap, int n_colors );
+unsigned short * colormap_lut( ColorMapObject * cmo );
+int map_pixels_to_colormap( unsigned short * lut, pixel * p, int n_pixels, GifByteType * raster );
+ExtensionBlock * frame_transparency( SavedImage * frame );
+ColorMapObject * make_local_colormap( ColorMapObject * cmo, GifByteType * raster, int n_pixels, int * transparent );
+int store_pixels( char * filename, animated_gif * image, int literal, int interframe );
+int store_encoded( char * filename, animated_gif * image, ColorMapObject * cmo,
+        GifByteType ** encoded, size_t * lengths );
+gif_writer * open_gif_writer( char * filename, animated_gif * image, int literal,
+        int * dup, int * unique );
+int write_gif_frame( gif_writer * w, int i );
+int close_gif_writer( gif_writer * w );
 int load_image_from_file(animated_gif **image , int *n_images, char *input_filename);
 void print_heuristics(int n_images, int n_process, int n_rounds, int n_parts_per_img[]);
 void printf_time(char* string, struct timeval t1, struct timeval t2);
@@ -38,6 +90,15 @@ void apply_sobel_filter_initial_one_image( animated_gif * image, int i );
 void apply_gray_filter_one_img(int width, int height, pixel *p);
 void apply_sobel_filter_one_img_col(int width, int height, pixel *p, pixel *sobel);
 void apply_blur_filter_one_iter_col( int width, int height, pixel *p, int size, int threshold, pixel *new_, int *end );
+void apply_sobel_filter_one_img_row(int width, int height, pixel *p, pixel *sobel);
+void apply_blur_filter_one_iter_row( int width, int height, pixel *p, int size, int threshold, pixel *new_, int *end );
+void apply_filters_one_frame(int width, int height, pixel *p, int size, int threshold);
+void init_filter_cache(filter_cache *cache);
+void free_filter_cache(filter_cache *cache);
+void apply_filters_one_frame_cached(int width, int height, pixel *p, int size, int threshold, filter_cache *cache, unsigned char *transparent);
+void apply_filters_one_frame_transparent(int width, int height, pixel *p, int size, int threshold, unsigned char *transparent);
+void copy_rows_to_columns(pixel *src, int src_width, int n_columns, int height, pixel *dst);
+void copy_columns_to_rows(pixel *src, int n_columns, int height, pixel *dst, int dst_width);
 
 
 #endif
\ No newline at end of file
@@ -88,6 +88,37 @@ then
 fi
 
 
+if [ "$1" = "short" ]
+then
+    if [ "$2" = "-h" ]
+    then
+        echo "USAGE: ./run_test.sh short [executable] [n_process]"
+    else
+        # 1 : test to run
+        # 2 : binary tester
+        # 3 : number of process
+        # Frames of less than 50 rows (and less than 2*SIZE_STENCIL+1): the blur must stay inside them
+        # ./run_test #1 #2 #3
+
+        INPUT_DIR=images/short
+        OUTPUT_DIR=images/processed
+        mkdir $OUTPUT_DIR 2>/dev/null
+
+        let "res = 0"
+        for i in $INPUT_DIR/*gif ; do
+            dest_filename=$OUTPUT_DIR/`basename $i .gif`-sobel.gif
+            echo "Running test on $i -> $dest_filename with $3 processes"
+            if ! timeout 60 mpirun -n $3 ./$2 $i $dest_filename > /dev/null
+            then
+                echo "FAILED on $i"
+                let "res = 1"
+            fi
+        done
+        exit $res
+    fi
+fi
+
+
 if [ "$1" = "initial" ]
 then
     # 1 : test to run
@@ -18,6 +18,9 @@ two modules will be linked.  Preserve this property!
 
 #ifdef _WIN32
 #include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif /* _WIN32 */
 
 #include "gif_lib.h"
@@ -36,10 +39,11 @@ static int DGifGetWord(GifFileType *GifFile, GifWord *Word);
 static int DGifSetupDecompress(GifFileType *GifFile);
 static int DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line,
                               int LineLen);
-static int DGifGetPrefixChar(GifPrefixType *Prefix, int Code, int ClearCode);
 static int DGifDecompressInput(GifFileType *GifFile, int *Code);
 static int DGifBufferedInput(GifFileType *GifFile, GifByteType *Buf,
                              GifByteType *NextByte);
+static long DGifTell(GifFileType *GifFile);
+static int DGifSeek(GifFileType *GifFile, long Offset, int Whence);
 
 /******************************************************************************
  Open a new GIF file for read, given by its name.
@@ -228,6 +232,101 @@ DGifOpen(void *userData, InputFunc readFunc, int *Error)
     return GifFile;
 }
 
+/******************************************************************************
+ Input function of DGifOpenMemory(). Only the small records go through it:
+ the image data blocks are read in place by DGifDecompressLine().
+******************************************************************************/
+static int
+DGifMemoryRead(GifFileType *GifFile, GifByteType *Buf, int Len)
+{
+    GifMemoryInput *In = (GifMemoryInput *)GifFile->UserData;
+
+    if ((size_t)Len > In->Size - In->Pos)
+        Len = In->Size - In->Pos;
+    memcpy(Buf, In->Data + In->Pos, Len);
+    In->Pos += Len;
+    return Len;
+}
+
+/******************************************************************************
+ Open a GIF file held in memory (Size bytes at Data), which must stay there
+ until DGifCloseFile(). Built on DGifOpen(): UserData is taken. Unlike other
+ input functions, the frames can be scanned and decoded in any order with
+ DGifScanFrames() and DGifDecodeFrame().
+******************************************************************************/
+GifFileType *
+DGifOpenMemory(const GifByteType *Data, size_t Size, int *Error)
+{
+    GifFileType *GifFile;
+    GifMemoryInput *In;
+
+    In = (GifMemoryInput *)malloc(sizeof(GifMemoryInput));
+    if (In == NULL) {
+        if (Error != NULL)
+	    *Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+        return NULL;
+    }
+    In->Data = Data;
+    In->Size = Size;
+    In->Pos = 0;
+    In->Mapped = false;
+
+    GifFile = DGifOpen(In, DGifMemoryRead, Error);
+    if (GifFile == NULL) {
+        free(In);
+        return NULL;
+    }
+    ((GifFilePrivateType *)GifFile->Private)->Memory = In;
+
+    return GifFile;
+}
+
+/******************************************************************************
+ Same as DGifOpenFileName(), but the file is mapped in memory and read as
+ with DGifOpenMemory(): no stdio call nor copy per data block. The mapping
+ is shared by all the processes opening the same file on a node.
+******************************************************************************/
+GifFileType *
+DGifOpenFileMapped(const char *FileName, int *Error)
+{
+#ifdef _WIN32
+    return DGifOpenFileName(FileName, Error);
+#else
+    int FileHandle;
+    struct stat Stat;
+    void *Data;
+    GifFileType *GifFile;
+
+    if ((FileHandle = open(FileName, O_RDONLY)) == -1) {
+        if (Error != NULL)
+	    *Error = D_GIF_ERR_OPEN_FAILED;
+        return NULL;
+    }
+    if (fstat(FileHandle, &Stat) != 0 || Stat.st_size == 0) {
+        (void)close(FileHandle);
+        if (Error != NULL)
+	    *Error = D_GIF_ERR_OPEN_FAILED;
+        return NULL;
+    }
+    Data = mmap(NULL, Stat.st_size, PROT_READ, MAP_PRIVATE, FileHandle, 0);
+    (void)close(FileHandle);    /* The mapping stays valid */
+    if (Data == MAP_FAILED) {
+        if (Error != NULL)
+	    *Error = D_GIF_ERR_OPEN_FAILED;
+        return NULL;
+    }
+
+    GifFile = DGifOpenMemory((GifByteType *)Data, Stat.st_size, Error);
+    if (GifFile == NULL) {
+        munmap(Data, Stat.st_size);
+        return NULL;
+    }
+    ((GifFilePrivateType *)GifFile->Private)->Memory->Mapped = true;
+
+    return GifFile;
+#endif /* _WIN32 */
+}
+
 /******************************************************************************
  This routine should be called before any other DGif calls. Note that
  this routine is called automatically from DGif file open routines.
@@ -394,21 +493,16 @@ DGifGetImageDesc(GifFileType *GifFile)
         }
     }
 
-    if (GifFile->SavedImages) {
+    /* Grows geometrically: no quadratic copying with thousands of frames */
+    {
         SavedImage* new_saved_images =
-            (SavedImage *)reallocarray(GifFile->SavedImages,
-                            (GifFile->ImageCount + 1), sizeof(SavedImage));
+            (SavedImage *)GifGrowArray(GifFile->SavedImages,
+                            GifFile->ImageCount, sizeof(SavedImage));
         if (new_saved_images == NULL) {
             GifFile->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
             return GIF_ERROR;
         }
         GifFile->SavedImages = new_saved_images;
-    } else {
-        if ((GifFile->SavedImages =
-             (SavedImage *) malloc(sizeof(SavedImage))) == NULL) {
-            GifFile->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
-            return GIF_ERROR;
-        }
     }
 
     sp = &GifFile->SavedImages[GifFile->ImageCount];
@@ -645,10 +739,24 @@ DGifCloseFile(GifFileType *GifFile, int *ErrorCode)
         GifFile->SavedImages = NULL;
     }
 
-    GifFreeExtensions(&GifFile->ExtensionBlockCount, &GifFile->ExtensionBlocks);
-
     Private = (GifFilePrivateType *) GifFile->Private;
 
+    /* Every extension block read is in the arena, freed at once */
+    if (Private->Arena == NULL)
+        GifFreeExtensions(&GifFile->ExtensionBlockCount, &GifFile->ExtensionBlocks);
+    GifFile->ExtensionBlocks = NULL;
+    GifFile->ExtensionBlockCount = 0;
+    GifArenaFree(&Private->Arena);
+
+    if (Private->Memory) {
+#ifndef _WIN32
+        if (Private->Memory->Mapped)
+            munmap((void *)Private->Memory->Data, Private->Memory->Size);
+#endif /* _WIN32 */
+        free(Private->Memory);
+        Private->Memory = NULL;
+    }
+
     if (!IS_READABLE(Private)) {
         /* This file was NOT open for reading: */
 	if (ErrorCode != NULL)
@@ -774,6 +882,7 @@ DGifSetupDecompress(GifFileType *GifFile)
     }
 
     Private->Buf[0] = 0;    /* Input Buffer empty. */
+    Private->BlockLeft = 0;
     Private->BitsPerPixel = BitsPerPixel;
     Private->ClearCode = (1 << BitsPerPixel);
     Private->EOFCode = Private->ClearCode + 1;
@@ -789,6 +898,12 @@ DGifSetupDecompress(GifFileType *GifFile)
     for (i = 0; i <= LZ_MAX_CODE; i++)
         Prefix[i] = NO_SUCH_CODE;
 
+    /* Pixel codes are strings of one pixel, never redefined: */
+    for (i = 0; i < Private->ClearCode; i++) {
+        Private->Length[i] = 1;
+        Private->FirstChar[i] = i;
+    }
+
     return GIF_OK;
 }
 
@@ -797,23 +912,51 @@ DGifSetupDecompress(GifFileType *GifFile)
  This version decompress the given GIF file into Line of length LineLen.
  This routine can be called few times (one per scan line, for example), in
  order the complete the whole image.
+ The length and first pixel of every code are kept with the table, so a
+ string is written directly at its place in Line by walking its prefixes
+ backwards: no stack and no extra walk for the first pixel, except when
+ the string does not fit in what is left of Line (the rest goes on the
+ stack, as before, for the next call). Codes are read from the bytes of the
+ current data block several at a time (64 bits buffer).
 ******************************************************************************/
 static int
 DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
 {
+    static const unsigned short CodeMasks[] = {
+	0x0000, 0x0001, 0x0003, 0x0007,
+	0x000f, 0x001f, 0x003f, 0x007f,
+	0x00ff, 0x01ff, 0x03ff, 0x07ff,
+	0x0fff
+    };
+    /* Bytes are added to the bit buffer while a whole byte still fits: */
+    const int MaxShiftState = 56;
+
     int i = 0;
-    int j, CrntCode, EOFCode, ClearCode, CrntPrefix, LastCode, StackPtr;
-    GifByteType *Stack, *Suffix;
-    GifPrefixType *Prefix;
+    int j, k, CrntCode, EOFCode, ClearCode, CrntPrefix, LastCode, StackPtr;
+    int RunningCode, RunningBits, MaxCode1, CrntShiftState;
+    uint64_t CrntShiftDWord;
+    GifByteType *Stack, *Suffix, *FirstChar, *Buf;
+    GifPrefixType *Prefix, *Length;
     GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+    GifMemoryInput *Memory = Private->Memory;
+    const GifByteType *BlockPtr = Private->BlockPtr;
+    int BlockLeft = Private->BlockLeft;
 
     StackPtr = Private->StackPtr;
     Prefix = Private->Prefix;
     Suffix = Private->Suffix;
+    Length = Private->Length;
+    FirstChar = Private->FirstChar;
     Stack = Private->Stack;
+    Buf = Private->Buf;
     EOFCode = Private->EOFCode;
     ClearCode = Private->ClearCode;
     LastCode = Private->LastCode;
+    RunningCode = Private->RunningCode;
+    RunningBits = Private->RunningBits;
+    MaxCode1 = Private->MaxCode1;
+    CrntShiftState = Private->CrntShiftState;
+    CrntShiftDWord = Private->CrntShiftDWord;
 
     if (StackPtr > LZ_MAX_CODE) {
         return GIF_ERROR;
@@ -826,8 +969,63 @@ DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
     }
 
     while (i < LineLen) {    /* Decode LineLen items. */
-        if (DGifDecompressInput(GifFile, &CrntCode) == GIF_ERROR)
+        /* The image can't contain more than LZ_BITS per code. */
+        if (RunningBits > LZ_BITS) {
+            GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
             return GIF_ERROR;
+        }
+
+        if (CrntShiftState < RunningBits && Memory != NULL) {
+            /* Read the data blocks in place, stopping before the empty
+             * block which ends the image: */
+            while (CrntShiftState <= MaxShiftState) {
+                if (BlockLeft == 0) {
+                    size_t Pos = Memory->Pos;
+                    if (Pos >= Memory->Size || Memory->Data[Pos] == 0
+                        || Pos + 1 + Memory->Data[Pos] > Memory->Size)
+                        break;
+                    BlockLeft = Memory->Data[Pos];
+                    BlockPtr = Memory->Data + Pos + 1;
+                    Memory->Pos = Pos + 1 + BlockLeft;
+                }
+                CrntShiftDWord |= ((uint64_t)*BlockPtr++) << CrntShiftState;
+                CrntShiftState += 8;
+                BlockLeft--;
+            }
+            if (CrntShiftState < RunningBits) {
+                GifFile->Error = (Memory->Pos < Memory->Size
+                                  && Memory->Data[Memory->Pos] == 0) ?
+                    D_GIF_ERR_IMAGE_DEFECT : D_GIF_ERR_READ_FAILED;
+                return GIF_ERROR;
+            }
+        } else if (CrntShiftState < RunningBits) {
+            /* Take as many bytes of the current block as possible, and
+             * only go to the next block when a code needs it: */
+            while (Buf[0] != 0 && CrntShiftState <= MaxShiftState) {
+                CrntShiftDWord |=
+                    ((uint64_t)Buf[Buf[1]++]) << CrntShiftState;
+                CrntShiftState += 8;
+                Buf[0]--;
+            }
+            while (CrntShiftState < RunningBits) {
+                GifByteType NextByte;
+                if (DGifBufferedInput(GifFile, Buf, &NextByte) == GIF_ERROR)
+                    return GIF_ERROR;
+                CrntShiftDWord |= ((uint64_t)NextByte) << CrntShiftState;
+                CrntShiftState += 8;
+            }
+        }
+        CrntCode = CrntShiftDWord & CodeMasks[RunningBits];
+        CrntShiftDWord >>= RunningBits;
+        CrntShiftState -= RunningBits;
+
+        /* Same code size update as in DGifDecompressInput(): */
+        if (RunningCode < LZ_MAX_CODE + 2 &&
+            ++RunningCode > MaxCode1 &&
+            RunningBits < LZ_BITS) {
+            MaxCode1 <<= 1;
+            RunningBits++;
+        }
 
         if (CrntCode == EOFCode) {
             /* Note however that usually we will not be here as we will stop
@@ -839,108 +1037,75 @@ DGifDecompressLine(GifFileType *GifFile, GifPixelType *Line, int LineLen)
             /* We need to start over again: */
             for (j = 0; j <= LZ_MAX_CODE; j++)
                 Prefix[j] = NO_SUCH_CODE;
-            Private->RunningCode = Private->EOFCode + 1;
-            Private->RunningBits = Private->BitsPerPixel + 1;
-            Private->MaxCode1 = 1 << Private->RunningBits;
-            LastCode = Private->LastCode = NO_SUCH_CODE;
-        } else {
-            /* Its regular code - if in pixel range simply add it to output
-             * stream, otherwise trace to codes linked list until the prefix
-             * is in pixel range: */
-            if (CrntCode < ClearCode) {
-                /* This is simple - its pixel scalar, so add it to output: */
-                Line[i++] = CrntCode;
-            } else {
-                /* Its a code to needed to be traced: trace the linked list
-                 * until the prefix is a pixel, while pushing the suffix
-                 * pixels on our stack. If we done, pop the stack in reverse
-                 * (thats what stack is good for!) order to output.  */
-                if (Prefix[CrntCode] == NO_SUCH_CODE) {
-                    CrntPrefix = LastCode;
-
-                    /* Only allowed if CrntCode is exactly the running code:
-                     * In that case CrntCode = XXXCode, CrntCode or the
-                     * prefix code is last code and the suffix char is
-                     * exactly the prefix of last code! */
-                    if (CrntCode == Private->RunningCode - 2) {
-                        Suffix[Private->RunningCode - 2] =
-                           Stack[StackPtr++] = DGifGetPrefixChar(Prefix,
-                                                                 LastCode,
-                                                                 ClearCode);
-                    } else {
-                        Suffix[Private->RunningCode - 2] =
-                           Stack[StackPtr++] = DGifGetPrefixChar(Prefix,
-                                                                 CrntCode,
-                                                                 ClearCode);
-                    }
-                } else
-                    CrntPrefix = CrntCode;
-
-                /* Now (if image is O.K.) we should not get a NO_SUCH_CODE
-                 * during the trace. As we might loop forever, in case of
-                 * defective image, we use StackPtr as loop counter and stop
-                 * before overflowing Stack[]. */
-                while (StackPtr < LZ_MAX_CODE &&
-                       CrntPrefix > ClearCode && CrntPrefix <= LZ_MAX_CODE) {
-                    Stack[StackPtr++] = Suffix[CrntPrefix];
-                    CrntPrefix = Prefix[CrntPrefix];
-                }
-                if (StackPtr >= LZ_MAX_CODE || CrntPrefix > LZ_MAX_CODE) {
-                    GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
-                    return GIF_ERROR;
-                }
-                /* Push the last character on stack: */
-                Stack[StackPtr++] = CrntPrefix;
+            RunningCode = EOFCode + 1;
+            RunningBits = Private->BitsPerPixel + 1;
+            MaxCode1 = 1 << RunningBits;
+            LastCode = NO_SUCH_CODE;
+            continue;
+        }
 
-                /* Now lets pop all the stack into output: */
-                while (StackPtr != 0 && i < LineLen)
-                    Line[i++] = Stack[--StackPtr];
-            }
-            if (LastCode != NO_SUCH_CODE && Prefix[Private->RunningCode - 2] == NO_SUCH_CODE) {
-                Prefix[Private->RunningCode - 2] = LastCode;
-
-                if (CrntCode == Private->RunningCode - 2) {
-                    /* Only allowed if CrntCode is exactly the running code:
-                     * In that case CrntCode = XXXCode, CrntCode or the
-                     * prefix code is last code and the suffix char is
-                     * exactly the prefix of last code! */
-                    Suffix[Private->RunningCode - 2] =
-                       DGifGetPrefixChar(Prefix, LastCode, ClearCode);
-                } else {
-                    Suffix[Private->RunningCode - 2] =
-                       DGifGetPrefixChar(Prefix, CrntCode, ClearCode);
-                }
+        /* Define the new code (LastCode followed by the first pixel of
+         * CrntCode) first: if CrntCode is exactly this code, its first
+         * pixel is the one of LastCode. */
+        k = RunningCode - 2;
+        if (LastCode != NO_SUCH_CODE && Prefix[k] == NO_SUCH_CODE) {
+            if (CrntCode < ClearCode || Prefix[CrntCode] != NO_SUCH_CODE)
+                Suffix[k] = FirstChar[CrntCode];
+            else if (CrntCode == k)
+                Suffix[k] = FirstChar[LastCode];
+            else {
+                GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+                return GIF_ERROR;
             }
-            LastCode = CrntCode;
+            Prefix[k] = LastCode;
+            Length[k] = Length[LastCode] + 1;
+            FirstChar[k] = FirstChar[LastCode];
+        }
+        LastCode = CrntCode;
+
+        if (CrntCode < ClearCode) {
+            /* This is simple - its pixel scalar, so add it to output: */
+            Line[i++] = CrntCode;
+            continue;
+        }
+        if (Prefix[CrntCode] == NO_SUCH_CODE || Length[CrntCode] > LZ_MAX_CODE) {
+            GifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+            return GIF_ERROR;
+        }
+
+        if (i + (int)Length[CrntCode] <= LineLen) {
+            /* The whole string fits: write it from its end */
+            j = i + Length[CrntCode] - 1;
+            for (CrntPrefix = CrntCode; CrntPrefix > ClearCode;
+                 CrntPrefix = Prefix[CrntPrefix])
+                Line[j--] = Suffix[CrntPrefix];
+            Line[j] = CrntPrefix;
+            i += Length[CrntCode];
+        } else {
+            /* Stack it in reverse order, and pop what fits in Line: */
+            for (CrntPrefix = CrntCode; CrntPrefix > ClearCode;
+                 CrntPrefix = Prefix[CrntPrefix])
+                Stack[StackPtr++] = Suffix[CrntPrefix];
+            Stack[StackPtr++] = CrntPrefix;
+
+            while (StackPtr != 0 && i < LineLen)
+                Line[i++] = Stack[--StackPtr];
         }
     }
 
     Private->LastCode = LastCode;
     Private->StackPtr = StackPtr;
+    Private->RunningCode = RunningCode;
+    Private->RunningBits = RunningBits;
+    Private->MaxCode1 = MaxCode1;
+    Private->CrntShiftState = CrntShiftState;
+    Private->CrntShiftDWord = CrntShiftDWord;
+    Private->BlockPtr = BlockPtr;
+    Private->BlockLeft = BlockLeft;
 
     return GIF_OK;
 }
 
-/******************************************************************************
- Routine to trace the Prefixes linked list until we get a prefix which is
- not code, but a pixel value (less than ClearCode). Returns that pixel value.
- If image is defective, we might loop here forever, so we limit the loops to
- the maximum possible if image O.k. - LZ_MAX_CODE times.
-******************************************************************************/
-static int
-DGifGetPrefixChar(GifPrefixType *Prefix, int Code, int ClearCode)
-{
-    int i = 0;
-
-    while (Code > ClearCode && i++ <= LZ_MAX_CODE) {
-        if (Code > LZ_MAX_CODE) {
-            return NO_SUCH_CODE;
-        }
-        Code = Prefix[Code];
-    }
-    return Code;
-}
-
 /******************************************************************************
  Interface for accessing the LZ codes directly. Set Code to the real code
  (12bits), or to -1 if EOF code is returned.
@@ -1010,7 +1175,7 @@ DGifDecompressInput(GifFileType *GifFile, int *Code)
             return GIF_ERROR;
         }
         Private->CrntShiftDWord |=
-	    ((unsigned long)NextByte) << Private->CrntShiftState;
+	    ((uint64_t)NextByte) << Private->CrntShiftState;
         Private->CrntShiftState += 8;
     }
     *Code = Private->CrntShiftDWord & CodeMasks[Private->RunningBits];
@@ -1079,6 +1244,7 @@ DGifBufferedInput(GifFileType *GifFile, GifByteType *Buf, GifByteType *NextByte)
 int
 DGifSlurp(GifFileType *GifFile)
 {
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
     size_t ImageSize;
     GifRecordType RecordType;
     SavedImage *sp;
@@ -1153,7 +1319,8 @@ DGifSlurp(GifFileType *GifFile)
                   return (GIF_ERROR);
 	      /* Create an extension block with our data */
               if (ExtData != NULL) {
-		  if (GifAddExtensionBlock(&GifFile->ExtensionBlockCount,
+		  if (GifArenaAddExtensionBlock(&Private->Arena,
+					   &GifFile->ExtensionBlockCount,
 					   &GifFile->ExtensionBlocks, 
 					   ExtFunction, ExtData[0], &ExtData[1])
 		      == GIF_ERROR)
@@ -1164,7 +1331,8 @@ DGifSlurp(GifFileType *GifFile)
                       return (GIF_ERROR);
                   /* Continue the extension block */
 		  if (ExtData != NULL)
-		      if (GifAddExtensionBlock(&GifFile->ExtensionBlockCount,
+		      if (GifArenaAddExtensionBlock(&Private->Arena,
+					       &GifFile->ExtensionBlockCount,
 					       &GifFile->ExtensionBlocks,
 					       CONTINUE_EXT_FUNC_CODE, 
 					       ExtData[0], &ExtData[1]) == GIF_ERROR)
@@ -1189,4 +1357,273 @@ DGifSlurp(GifFileType *GifFile)
     return (GIF_OK);
 }
 
+/******************************************************************************
+ Position in the input of DGifScanFrames() and DGifDecodeFrame(): a file
+ read with stdio, or memory. Returns -1 for other input functions.
+******************************************************************************/
+static long
+DGifTell(GifFileType *GifFile)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (Private->Memory != NULL)
+        return (long)Private->Memory->Pos;
+    if (Private->Read != NULL || Private->File == NULL)
+        return -1;
+    return ftell(Private->File);
+}
+
+/* Same as fseek(), on the inputs DGifTell() knows. Returns 0 if done. */
+static int
+DGifSeek(GifFileType *GifFile, long Offset, int Whence)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (Private->Memory != NULL) {
+        GifMemoryInput *In = Private->Memory;
+        if (Whence == SEEK_CUR)
+            Offset += (long)In->Pos;
+        if (Offset < 0 || (size_t)Offset > In->Size)
+            return -1;
+        In->Pos = Offset;
+        return 0;
+    }
+    if (Private->Read != NULL || Private->File == NULL)
+        return -1;
+    return fseek(Private->File, Offset, Whence);
+}
+
+/******************************************************************************
+ This routine reads the whole GIF like DGifSlurp(), but skips the compressed
+ data of the images instead of decoding it: SavedImages get their descriptors
+ and extensions with RasterBits left NULL. Index is allocated here and gets
+ one entry per image, so that DGifDecodeFrame() can decode any image later,
+ from any GifFileType opened on the same file. Needs a seekable file, or
+ one opened with DGifOpenMemory() / DGifOpenFileMapped().
+*******************************************************************************/
+int
+DGifScanFrames(GifFileType *GifFile, GifFrameIndex **Index)
+{
+    GifRecordType RecordType;
+    SavedImage *sp;
+    GifByteType *ExtData;
+    GifByteType Len;
+    int ExtFunction, IndexSize = 0;
+    long DescOffset;
+    GifFrameIndex *Frames = NULL, *NewFrames;
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    *Index = NULL;
+    if (DGifTell(GifFile) < 0) {
+        /* Offsets only make sense for a file we can seek in */
+        GifFile->Error = D_GIF_ERR_NOT_READABLE;
+        return GIF_ERROR;
+    }
+
+    GifFile->ExtensionBlocks = NULL;
+    GifFile->ExtensionBlockCount = 0;
+
+    do {
+        if (DGifGetRecordType(GifFile, &RecordType) == GIF_ERROR)
+            goto fail;
+
+        switch (RecordType) {
+          case IMAGE_DESC_RECORD_TYPE:
+              DescOffset = DGifTell(GifFile);
+              if (DGifGetImageDesc(GifFile) == GIF_ERROR)
+                  goto fail;
+
+              if (GifFile->ImageCount > IndexSize) {
+                  IndexSize = IndexSize ? 2 * IndexSize : 16;
+                  NewFrames = (GifFrameIndex *)reallocarray(Frames,
+                                  IndexSize, sizeof(GifFrameIndex));
+                  if (NewFrames == NULL) {
+                      GifFile->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+                      goto fail;
+                  }
+                  Frames = NewFrames;
+              }
+
+              sp = &GifFile->SavedImages[GifFile->ImageCount - 1];
+              Frames[GifFile->ImageCount - 1].DescOffset = DescOffset;
+              /* DGifGetImageDesc() already read the code size byte */
+              Frames[GifFile->ImageCount - 1].DataOffset =
+                  DGifTell(GifFile) - 1;
+              Frames[GifFile->ImageCount - 1].CodeSize = Private->BitsPerPixel;
+              Frames[GifFile->ImageCount - 1].Left = sp->ImageDesc.Left;
+              Frames[GifFile->ImageCount - 1].Top = sp->ImageDesc.Top;
+              Frames[GifFile->ImageCount - 1].Width = sp->ImageDesc.Width;
+              Frames[GifFile->ImageCount - 1].Height = sp->ImageDesc.Height;
+              Frames[GifFile->ImageCount - 1].Interlace =
+                  sp->ImageDesc.Interlace;
+              Frames[GifFile->ImageCount - 1].HasColorMap =
+                  (sp->ImageDesc.ColorMap != NULL);
+
+              /* Skip the data sub-blocks without reading them */
+              do {
+                  if (READ(GifFile, &Len, 1) != 1) {
+                      GifFile->Error = D_GIF_ERR_READ_FAILED;
+                      goto fail;
+                  }
+                  if (Len > 0 && DGifSeek(GifFile, Len, SEEK_CUR) != 0) {
+                      GifFile->Error = D_GIF_ERR_READ_FAILED;
+                      goto fail;
+                  }
+              } while (Len > 0);
+
+              if (GifFile->ExtensionBlocks) {
+                  sp->ExtensionBlocks = GifFile->ExtensionBlocks;
+                  sp->ExtensionBlockCount = GifFile->ExtensionBlockCount;
+
+                  GifFile->ExtensionBlocks = NULL;
+                  GifFile->ExtensionBlockCount = 0;
+              }
+              break;
+
+          case EXTENSION_RECORD_TYPE:
+              if (DGifGetExtension(GifFile,&ExtFunction,&ExtData) == GIF_ERROR)
+                  goto fail;
+	      /* Create an extension block with our data */
+              if (ExtData != NULL) {
+		  if (GifArenaAddExtensionBlock(&Private->Arena,
+					   &GifFile->ExtensionBlockCount,
+					   &GifFile->ExtensionBlocks, 
+					   ExtFunction, ExtData[0], &ExtData[1])
+		      == GIF_ERROR)
+		      goto fail;
+	      }
+              while (ExtData != NULL) {
+                  if (DGifGetExtensionNext(GifFile, &ExtData) == GIF_ERROR)
+                      goto fail;
+                  /* Continue the extension block */
+		  if (ExtData != NULL)
+		      if (GifArenaAddExtensionBlock(&Private->Arena,
+					       &GifFile->ExtensionBlockCount,
+					       &GifFile->ExtensionBlocks,
+					       CONTINUE_EXT_FUNC_CODE, 
+					       ExtData[0], &ExtData[1]) == GIF_ERROR)
+                      goto fail;
+              }
+              break;
+
+          case TERMINATE_RECORD_TYPE:
+              break;
+
+          default:    /* Should be trapped by DGifGetRecordType */
+              break;
+        }
+    } while (RecordType != TERMINATE_RECORD_TYPE);
+
+    /* Sanity check for corrupted file */
+    if (GifFile->ImageCount == 0) {
+	GifFile->Error = D_GIF_ERR_NO_IMAG_DSCR;
+	goto fail;
+    }
+
+    *Index = Frames;
+    return (GIF_OK);
+
+fail:
+    free(Frames);
+    return (GIF_ERROR);
+}
+
+/******************************************************************************
+ Read again the local colormap of an image found by DGifScanFrames() into
+ GifFile->Image.ColorMap: it follows the 9 bytes of the image descriptor.
+*******************************************************************************/
+static int
+DGifReadFrameColorMap(GifFileType *GifFile, const GifFrameIndex *Frame)
+{
+    GifByteType Buf[3];
+    int i;
+
+    if (DGifSeek(GifFile, Frame->DescOffset + 8, SEEK_SET) != 0 ||
+        READ(GifFile, Buf, 1) != 1) {
+        GifFile->Error = D_GIF_ERR_READ_FAILED;
+        return GIF_ERROR;
+    }
+
+    GifFile->Image.ColorMap = GifMakeMapObject(1 << ((Buf[0] & 0x07) + 1),
+                                               NULL);
+    if (GifFile->Image.ColorMap == NULL) {
+        GifFile->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+        return GIF_ERROR;
+    }
+
+    for (i = 0; i < GifFile->Image.ColorMap->ColorCount; i++) {
+        if (READ(GifFile, Buf, 3) != 3) {
+            GifFreeMapObject(GifFile->Image.ColorMap);
+            GifFile->Image.ColorMap = NULL;
+            GifFile->Error = D_GIF_ERR_READ_FAILED;
+            return GIF_ERROR;
+        }
+        GifFile->Image.ColorMap->Colors[i].Red = Buf[0];
+        GifFile->Image.ColorMap->Colors[i].Green = Buf[1];
+        GifFile->Image.ColorMap->Colors[i].Blue = Buf[2];
+    }
+
+    return GIF_OK;
+}
+
+/******************************************************************************
+ Decode one image found by DGifScanFrames() into RasterBits, which must hold
+ Frame->Width * Frame->Height pixels. GifFile only needs to be opened on the
+ same file: images can be decoded in any order. As with DGifGetImageDesc(),
+ GifFile->Image.ColorMap is then the local colormap of the image (NULL if it
+ uses the global one).
+*******************************************************************************/
+int
+DGifDecodeFrame(GifFileType *GifFile, const GifFrameIndex *Frame,
+                GifPixelType *RasterBits)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (!IS_READABLE(Private)) {
+        /* This file was NOT open for reading: */
+        GifFile->Error = D_GIF_ERR_NOT_READABLE;
+        return GIF_ERROR;
+    }
+
+    GifFreeMapObject(GifFile->Image.ColorMap);
+    GifFile->Image.ColorMap = NULL;
+    if (Frame->HasColorMap && DGifReadFrameColorMap(GifFile, Frame) == GIF_ERROR)
+        return GIF_ERROR;
+
+    if (DGifSeek(GifFile, Frame->DataOffset, SEEK_SET) != 0) {
+        GifFile->Error = D_GIF_ERR_READ_FAILED;
+        return GIF_ERROR;
+    }
+
+    GifFile->Image.Left = Frame->Left;
+    GifFile->Image.Top = Frame->Top;
+    GifFile->Image.Width = Frame->Width;
+    GifFile->Image.Height = Frame->Height;
+    GifFile->Image.Interlace = Frame->Interlace;
+    Private->PixelCount = (long)Frame->Width * (long)Frame->Height;
+    if (DGifSetupDecompress(GifFile) == GIF_ERROR)
+        return GIF_ERROR;
+
+    if (Frame->Interlace) {
+	int i, j;
+	/* Same passes as in DGifSlurp() */
+	int InterlacedOffset[] = { 0, 4, 2, 1 };
+	int InterlacedJumps[] = { 8, 8, 4, 2 };
+	for (i = 0; i < 4; i++)
+	    for (j = InterlacedOffset[i]; j < Frame->Height;
+		 j += InterlacedJumps[i]) {
+		if (DGifGetLine(GifFile, RasterBits + j * Frame->Width,
+				Frame->Width) == GIF_ERROR)
+		    return GIF_ERROR;
+	    }
+    }
+    else {
+	if (DGifGetLine(GifFile, RasterBits,
+			Frame->Width * Frame->Height) == GIF_ERROR)
+	    return GIF_ERROR;
+    }
+
+    return (GIF_OK);
+}
+
 /* end */
@@ -36,9 +36,10 @@ static int EGifPutWord(int Word, GifFileType * GifFile);
 static int EGifSetupCompress(GifFileType * GifFile);
 static int EGifCompressLine(GifFileType * GifFile, GifPixelType * Line,
                             int LineLen);
+static int EGifCompressLiteral(GifFileType * GifFile, GifPixelType * Line,
+                               int LineLen);
 static int EGifCompressOutput(GifFileType * GifFile, int Code);
-static int EGifBufferedOutput(GifFileType * GifFile, GifByteType * Buf,
-                              int c);
+static int EGifWriteBlocks(GifFileType * GifFile, bool Last);
 
 /* extract bytes from an unsigned word */
 #define LOBYTE(x)	((x) & 0xff)
@@ -104,7 +105,7 @@ EGifOpenFileHandle(const int FileHandle, int *Error)
         return NULL;
     }
     /*@i1@*/memset(Private, '\0', sizeof(GifFilePrivateType));
-    if ((Private->HashTable = _InitHashTable()) == NULL) {
+    if ((Private->CodeTable = _InitCodeTable()) == NULL) {
         free(GifFile);
         free(Private);
         if (Error != NULL)
@@ -161,8 +162,8 @@ EGifOpen(void *userData, OutputFunc writeFunc, int *Error)
 
     memset(Private, '\0', sizeof(GifFilePrivateType));
 
-    Private->HashTable = _InitHashTable();
-    if (Private->HashTable == NULL) {
+    Private->CodeTable = _InitCodeTable();
+    if (Private->CodeTable == NULL) {
         free (GifFile);
         free (Private);
         if (Error != NULL)
@@ -242,6 +243,19 @@ void EGifSetGifVersion(GifFileType *GifFile, const bool gif89)
     Private->gif89 = gif89;
 }
 
+/******************************************************************************
+ Store the images without compression: every pixel is written as its own
+ literal code, and a clear code is sent before the decoder would widen the
+ codes, so the data stays valid GIF for any decoder. Much faster than LZW,
+ for outputs read back at once, but bigger.
+******************************************************************************/
+void EGifSetLiteralCodes(GifFileType *GifFile, const bool Literal)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+
+    Private->LiteralCodes = Literal;
+}
+
 /******************************************************************************
  All writes to the GIF should go through this.
 ******************************************************************************/
@@ -466,6 +480,8 @@ EGifPutLine(GifFileType * GifFile, GifPixelType *Line, int LineLen)
     for (i = 0; i < LineLen; i++)
         Line[i] &= Mask;
 
+    if (Private->LiteralCodes)
+        return EGifCompressLiteral(GifFile, Line, LineLen);
     return EGifCompressLine(GifFile, Line, LineLen);
 }
 
@@ -493,6 +509,8 @@ EGifPutPixel(GifFileType *GifFile, GifPixelType Pixel)
      * wrong code (because of overflow when we combine them) in this case: */
     Pixel &= CodeMask[Private->BitsPerPixel];
 
+    if (Private->LiteralCodes)
+        return EGifCompressLiteral(GifFile, &Pixel, 1);
     return EGifCompressLine(GifFile, &Pixel, 1);
 }
 
@@ -667,6 +685,7 @@ size_t EGifGCBToExtension(const GraphicsControlBlock *GCB,
 int EGifGCBToSavedExtension(const GraphicsControlBlock *GCB, 
 			    GifFileType *GifFile, int ImageIndex)
 {
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
     int i;
     size_t Len;
     GifByteType buf[sizeof(GraphicsControlBlock)]; /* a bit dodgy... */
@@ -682,8 +701,10 @@ int EGifGCBToSavedExtension(const GraphicsControlBlock *GCB,
 	}
     }
 
+    /* In the arena of the file if it was read */
     Len = EGifGCBToExtension(GCB, (GifByteType *)buf);
-    if (GifAddExtensionBlock(&GifFile->SavedImages[ImageIndex].ExtensionBlockCount,
+    if (GifArenaAddExtensionBlock((Private && Private->Arena) ? &Private->Arena : NULL,
+			     &GifFile->SavedImages[ImageIndex].ExtensionBlockCount,
 			     &GifFile->SavedImages[ImageIndex].ExtensionBlocks,
 			     GRAPHICS_EXT_FUNC_CODE,
 			     Len,
@@ -790,9 +811,7 @@ EGifCloseFile(GifFileType *GifFile, int *ErrorCode)
         GifFile->SColorMap = NULL;
     }
     if (Private) {
-        if (Private->HashTable) {
-            free((char *) Private->HashTable);
-        }
+        _FreeCodeTable(Private->CodeTable);
 	free((char *) Private);
     }
 
@@ -848,7 +867,7 @@ EGifSetupCompress(GifFileType *GifFile)
     Buf = BitsPerPixel = (BitsPerPixel < 2 ? 2 : BitsPerPixel);
     InternalWrite(GifFile, &Buf, 1);    /* Write the Code size to file. */
 
-    Private->Buf[0] = 0;    /* Nothing was output yet. */
+    Private->PackedLen = 0;    /* Nothing was output yet. */
     Private->BitsPerPixel = BitsPerPixel;
     Private->ClearCode = (1 << BitsPerPixel);
     Private->EOFCode = Private->ClearCode + 1;
@@ -858,9 +877,14 @@ EGifSetupCompress(GifFileType *GifFile)
     Private->CrntCode = FIRST_CODE;    /* Signal that this is first one! */
     Private->CrntShiftState = 0;    /* No information in CrntShiftDWord. */
     Private->CrntShiftDWord = 0;
+    Private->LiteralCount = 0;
 
-   /* Clear hash table and send Clear to make sure the decoder do the same. */
-    _ClearHashTable(Private->HashTable);
+   /* Clear code table and send Clear to make sure the decoder do the same. */
+    if (!Private->LiteralCodes
+        && _ClearCodeTable(Private->CodeTable, BitsPerPixel) == GIF_ERROR) {
+        GifFile->Error = E_GIF_ERR_NOT_ENOUGH_MEM;
+        return GIF_ERROR;
+    }
 
     if (EGifCompressOutput(GifFile, Private->ClearCode) == GIF_ERROR) {
         GifFile->Error = E_GIF_ERR_DISK_IS_FULL;
@@ -874,19 +898,21 @@ EGifSetupCompress(GifFileType *GifFile)
  This version compresses the given buffer Line of length LineLen.
  This routine can be called a few times (one per scan line, for example), in
  order to complete the whole image.
+ When the current string is a run of the next pixel, the whole run of this
+ pixel in Line is taken at once: the code table knows the code of every run
+ up to the longest one, so only the codes written out cost something.
 ******************************************************************************/
 static int
 EGifCompressLine(GifFileType *GifFile,
                  GifPixelType *Line,
                  const int LineLen)
 {
-    int i = 0, CrntCode, NewCode;
-    unsigned long NewKey;
+    int i = 0, CrntCode, NewCode, PrefixCode;
     GifPixelType Pixel;
-    GifHashTableType *HashTable;
+    GifCodeTableType *CodeTable;
     GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
 
-    HashTable = Private->HashTable;
+    CodeTable = Private->CodeTable;
 
     if (Private->CrntCode == FIRST_CODE)    /* Its first time! */
         CrntCode = Line[i++];
@@ -894,28 +920,69 @@ EGifCompressLine(GifFileType *GifFile,
         CrntCode = Private->CrntCode;    /* Get last code in compression. */
 
     while (i < LineLen) {   /* Decode LineLen items. */
-        Pixel = Line[i++];  /* Get next pixel from stream. */
-        /* Form a new unique key to search hash table for the code combines 
-         * CrntCode as Prefix string with Pixel as postfix char.
+        Pixel = Line[i];
+        if (CodeTable->RunLength[CrntCode] != 0
+            && CodeTable->RunPixel[CrntCode] == Pixel) {
+            /* Extend the run of CrntCode with the R pixels of the run: */
+            int End = i + 1, R, Length = CodeTable->RunLength[CrntCode];
+            while (End < LineLen && Line[End] == Pixel)
+                End++;
+            R = End - i;
+            i = End;
+
+            while (Length + R > CodeTable->RunCount[Pixel]) {
+                /* Up to the longest run known, whose code is written out,
+                 * and the next pixel starts a new string: */
+                int Longest = CodeTable->RunCount[Pixel];
+                R -= Longest - Length + 1;
+                PrefixCode = CT_RUN_CODE(CodeTable, Pixel, Longest);
+                if (EGifCompressOutput(GifFile, PrefixCode) == GIF_ERROR) {
+                    GifFile->Error = E_GIF_ERR_DISK_IS_FULL;
+                    return GIF_ERROR;
+                }
+                Length = 1;
+
+                /* Same as below when a string is not in the table: */
+                if (Private->RunningCode >= LZ_MAX_CODE) {
+                    if (EGifCompressOutput(GifFile, Private->ClearCode)
+                            == GIF_ERROR) {
+                        GifFile->Error = E_GIF_ERR_DISK_IS_FULL;
+                        return GIF_ERROR;
+                    }
+                    Private->RunningCode = Private->EOFCode + 1;
+                    Private->RunningBits = Private->BitsPerPixel + 1;
+                    Private->MaxCode1 = 1 << Private->RunningBits;
+                    _ClearCodeTable(CodeTable, Private->BitsPerPixel);
+                } else {
+                    _InsertCodeTable(CodeTable, PrefixCode, Pixel,
+                                     Private->RunningCode++);
+                }
+            }
+            CrntCode = CT_RUN_CODE(CodeTable, Pixel, Length + R);
+            continue;
+        }
+        i++;
+        /* Look for the code of CrntCode as Prefix string with Pixel as
+         * postfix char.
          */
-        NewKey = (((uint32_t) CrntCode) << 8) + Pixel;
-        if ((NewCode = _ExistsHashTable(HashTable, NewKey)) >= 0) {
+        if ((NewCode = _ExistsCodeTable(CodeTable, CrntCode, Pixel)) >= 0) {
             /* This Key is already there, or the string is old one, so
              * simple take new code as our CrntCode:
              */
             CrntCode = NewCode;
         } else {
-            /* Put it in hash table, output the prefix code, and make our
+            /* Put it in code table, output the prefix code, and make our
              * CrntCode equal to Pixel.
              */
             if (EGifCompressOutput(GifFile, CrntCode) == GIF_ERROR) {
                 GifFile->Error = E_GIF_ERR_DISK_IS_FULL;
                 return GIF_ERROR;
             }
+            PrefixCode = CrntCode;
             CrntCode = Pixel;
 
-            /* If however the HashTable if full, we send a clear first and
-             * Clear the hash table.
+            /* If however the code table if full, we send a clear first and
+             * Clear the code table.
              */
             if (Private->RunningCode >= LZ_MAX_CODE) {
                 /* Time to do some clearance: */
@@ -927,10 +994,11 @@ EGifCompressLine(GifFileType *GifFile,
                 Private->RunningCode = Private->EOFCode + 1;
                 Private->RunningBits = Private->BitsPerPixel + 1;
                 Private->MaxCode1 = 1 << Private->RunningBits;
-                _ClearHashTable(HashTable);
+                _ClearCodeTable(CodeTable, Private->BitsPerPixel);
             } else {
-                /* Put this unique key with its relative Code in hash table: */
-                _InsertHashTable(HashTable, NewKey, Private->RunningCode++);
+                /* Put this unique string with its relative Code in table: */
+                _InsertCodeTable(CodeTable, PrefixCode, Pixel,
+                                 Private->RunningCode++);
             }
         }
 
@@ -958,10 +1026,81 @@ EGifCompressLine(GifFileType *GifFile,
     return GIF_OK;
 }
 
+/******************************************************************************
+ The store-only counterpart of EGifCompressLine(), see EGifSetLiteralCodes().
+ The decoder adds a string to its table for every code but the first after
+ a clear, and widens its codes once its table reaches 2^(BitsPerPixel+1):
+ after a clear, 2^BitsPerPixel - 2 literals and the next clear still fit in
+ BitsPerPixel + 1 bits. Our own RunningCode never moves, so neither do ours.
+******************************************************************************/
+static int
+EGifCompressLiteral(GifFileType *GifFile,
+                    GifPixelType *Line,
+                    const int LineLen)
+{
+    int i, MaxLiterals, Count, Bits, State, Len;
+    uint64_t DWord;
+    GifByteType *Packed;
+    GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+
+    /* Same packing as EGifCompressOutput(), kept in locals: */
+    MaxLiterals = (1 << Private->BitsPerPixel) - 2;
+    Count = Private->LiteralCount;
+    Bits = Private->RunningBits;
+    State = Private->CrntShiftState;
+    DWord = Private->CrntShiftDWord;
+    Packed = Private->PackedBuf;
+    Len = Private->PackedLen;
+    for (i = 0; i < LineLen; i++) {
+        if (Count == MaxLiterals) {
+            DWord |= ((uint64_t)Private->ClearCode) << State;
+            State += Bits;
+            Count = 0;
+        }
+        DWord |= ((uint64_t)Line[i]) << State;
+        State += Bits;
+        Count++;
+        if (State >= 32) {
+            Packed[Len] = DWord & 0xff;
+            Packed[Len + 1] = (DWord >> 8) & 0xff;
+            Packed[Len + 2] = (DWord >> 16) & 0xff;
+            Packed[Len + 3] = (DWord >> 24) & 0xff;
+            Len += 4;
+            DWord >>= 32;
+            State -= 32;
+            if (Len >= PACKED_BLOCKS * 255) {
+                Private->PackedLen = Len;
+                if (EGifWriteBlocks(GifFile, false) == GIF_ERROR)
+                    return GIF_ERROR;
+                Len = Private->PackedLen;
+            }
+        }
+    }
+    Private->LiteralCount = Count;
+    Private->CrntShiftState = State;
+    Private->CrntShiftDWord = DWord;
+    Private->PackedLen = Len;
+
+    if (Private->PixelCount == 0) {
+        /* We are done - output EOF code and flush output buffers: */
+        if (EGifCompressOutput(GifFile, Private->EOFCode) == GIF_ERROR) {
+            GifFile->Error = E_GIF_ERR_DISK_IS_FULL;
+            return GIF_ERROR;
+        }
+        if (EGifCompressOutput(GifFile, FLUSH_OUTPUT) == GIF_ERROR) {
+            GifFile->Error = E_GIF_ERR_DISK_IS_FULL;
+            return GIF_ERROR;
+        }
+    }
+
+    return GIF_OK;
+}
+
 /******************************************************************************
  The LZ compression output routine:
  This routine is responsible for the compression of the bit stream into
- 8 bits (bytes) packets.
+ 8 bits (bytes) packets. Codes go through a 64 bits buffer, dumped 4 bytes
+ at a time into PackedBuf, which is cut into data blocks by EGifWriteBlocks.
  Returns GIF_OK if written successfully.
 ******************************************************************************/
 static int
@@ -969,31 +1108,37 @@ EGifCompressOutput(GifFileType *GifFile,
                    const int Code)
 {
     GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+    GifByteType *Packed = Private->PackedBuf;
     int retval = GIF_OK;
 
     if (Code == FLUSH_OUTPUT) {
         while (Private->CrntShiftState > 0) {
             /* Get Rid of what is left in DWord, and flush it. */
-            if (EGifBufferedOutput(GifFile, Private->Buf,
-                                 Private->CrntShiftDWord & 0xff) == GIF_ERROR)
-                retval = GIF_ERROR;
+            Packed[Private->PackedLen++] = Private->CrntShiftDWord & 0xff;
             Private->CrntShiftDWord >>= 8;
             Private->CrntShiftState -= 8;
         }
         Private->CrntShiftState = 0;    /* For next time. */
-        if (EGifBufferedOutput(GifFile, Private->Buf,
-                               FLUSH_OUTPUT) == GIF_ERROR)
+        if (EGifWriteBlocks(GifFile, true) == GIF_ERROR)
             retval = GIF_ERROR;
     } else {
-        Private->CrntShiftDWord |= ((long)Code) << Private->CrntShiftState;
+        Private->CrntShiftDWord |= ((uint64_t)Code) << Private->CrntShiftState;
         Private->CrntShiftState += Private->RunningBits;
-        while (Private->CrntShiftState >= 8) {
-            /* Dump out full bytes: */
-            if (EGifBufferedOutput(GifFile, Private->Buf,
-                                 Private->CrntShiftDWord & 0xff) == GIF_ERROR)
+        if (Private->CrntShiftState >= 32) {
+            /* Dump out 4 full bytes: */
+            uint64_t DWord = Private->CrntShiftDWord;
+            int Len = Private->PackedLen;
+            Packed[Len] = DWord & 0xff;
+            Packed[Len + 1] = (DWord >> 8) & 0xff;
+            Packed[Len + 2] = (DWord >> 16) & 0xff;
+            Packed[Len + 3] = (DWord >> 24) & 0xff;
+            Private->PackedLen = Len + 4;
+            Private->CrntShiftDWord = DWord >> 32;
+            Private->CrntShiftState -= 32;
+
+            if (Private->PackedLen >= PACKED_BLOCKS * 255
+                && EGifWriteBlocks(GifFile, false) == GIF_ERROR)
                 retval = GIF_ERROR;
-            Private->CrntShiftDWord >>= 8;
-            Private->CrntShiftState -= 8;
         }
     }
 
@@ -1007,39 +1152,40 @@ EGifCompressOutput(GifFileType *GifFile,
 }
 
 /******************************************************************************
- This routines buffers the given characters until 255 characters are ready
- to be output. If Code is equal to -1 the buffer is flushed (EOF).
- The buffer is Dumped with first byte as its size, as GIF format requires.
+ This routine cuts the packed bytes into blocks of 255 bytes, each dumped
+ with first byte as its size, as GIF format requires, and writes them at
+ once. Unless this is the Last call for the image, an incomplete block is
+ kept for next time; otherwise it is written too, followed by an empty
+ block to mark the end of compressed data.
  Returns GIF_OK if written successfully.
 ******************************************************************************/
 static int
-EGifBufferedOutput(GifFileType *GifFile,
-                   GifByteType *Buf,
-                   int c)
+EGifWriteBlocks(GifFileType *GifFile, bool Last)
 {
-    if (c == FLUSH_OUTPUT) {
-        /* Flush everything out. */
-        if (Buf[0] != 0
-            && InternalWrite(GifFile, Buf, Buf[0] + 1) != (unsigned)(Buf[0] + 1)) {
-            GifFile->Error = E_GIF_ERR_WRITE_FAILED;
-            return GIF_ERROR;
-        }
-        /* Mark end of compressed data, by an empty block (see GIF doc): */
-        Buf[0] = 0;
-        if (InternalWrite(GifFile, Buf, 1) != 1) {
-            GifFile->Error = E_GIF_ERR_WRITE_FAILED;
-            return GIF_ERROR;
-        }
-    } else {
-        if (Buf[0] == 255) {
-            /* Dump out this buffer - it is full: */
-            if (InternalWrite(GifFile, Buf, Buf[0] + 1) != (unsigned)(Buf[0] + 1)) {
-                GifFile->Error = E_GIF_ERR_WRITE_FAILED;
-                return GIF_ERROR;
-            }
-            Buf[0] = 0;
-        }
-        Buf[++Buf[0]] = c;
+    GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+    GifByteType *Packed = Private->PackedBuf, *Blocks = Private->BlockBuf;
+    int Done = 0, Len = 0;
+
+    while (Private->PackedLen - Done >= 255
+           || (Last && Private->PackedLen - Done > 0)) {
+        int BlockLen = Private->PackedLen - Done;
+        if (BlockLen > 255)
+            BlockLen = 255;
+        Blocks[Len++] = BlockLen;
+        memcpy(Blocks + Len, Packed + Done, BlockLen);
+        Len += BlockLen;
+        Done += BlockLen;
+    }
+    if (Last)
+        Blocks[Len++] = 0;
+
+    Private->PackedLen -= Done;
+    if (Private->PackedLen > 0)
+        memmove(Packed, Packed + Done, Private->PackedLen);
+
+    if (Len > 0 && InternalWrite(GifFile, Blocks, Len) != (size_t)Len) {
+        GifFile->Error = E_GIF_ERR_WRITE_FAILED;
+        return GIF_ERROR;
     }
 
     return GIF_OK;
@@ -1151,4 +1297,209 @@ EGifSpew(GifFileType *GifFileOut)
     return (GIF_OK);
 }
 
+/******************************************************************************
+ Memory output used by EGifEncodeImage(): the buffer grows as needed.
+******************************************************************************/
+typedef struct GifMemoryOutput {
+    GifByteType *Data;
+    size_t Length, Capacity;
+} GifMemoryOutput;
+
+static int
+EGifMemoryWrite(GifFileType *GifFile, const GifByteType *Buf, int Len)
+{
+    GifMemoryOutput *Out = (GifMemoryOutput *)GifFile->UserData;
+
+    if (Out->Length + Len > Out->Capacity) {
+        size_t NewCapacity = Out->Capacity ? 2 * Out->Capacity : 4096;
+        GifByteType *NewData;
+
+        while (Out->Length + Len > NewCapacity)
+            NewCapacity *= 2;
+        NewData = (GifByteType *)realloc(Out->Data, NewCapacity);
+        if (NewData == NULL)
+            return 0;
+        Out->Data = NewData;
+        Out->Capacity = NewCapacity;
+    }
+    memcpy(Out->Data + Out->Length, Buf, Len);
+    Out->Length += Len;
+    return Len;
+}
+
+/******************************************************************************
+ Compress one image in memory, without writing a file: Buffer (allocated
+ here) gets the image data exactly as EGifSpew() would write it after the
+ image descriptor: LZW code size, data sub-blocks and the empty block.
+ ColorMap is the one the image will be written with (global or local), it
+ is only used for its number of bits per pixel. RasterBits is masked to it.
+ Literal stores the pixels without compression (see EGifSetLiteralCodes()).
+ The result can be given to EGifSpewEncoded().
+******************************************************************************/
+int
+EGifEncodeImage(const ColorMapObject *ColorMap,
+                const int Width, const int Height, const bool Interlace,
+                const bool Literal,
+                GifPixelType *RasterBits,
+                GifByteType **Buffer, size_t *Length, int *Error)
+{
+    GifFileType *GifFile;
+    GifFilePrivateType *Private;
+    GifMemoryOutput Out = { NULL, 0, 0 };
+    int j, ErrorCode = E_GIF_SUCCEEDED;
+
+    *Buffer = NULL;
+    *Length = 0;
+    if (ColorMap == NULL) {
+        if (Error != NULL)
+            *Error = E_GIF_ERR_NO_COLOR_MAP;
+        return GIF_ERROR;
+    }
+
+    GifFile = EGifOpen(&Out, EGifMemoryWrite, Error);
+    if (GifFile == NULL)
+        return GIF_ERROR;
+    Private = (GifFilePrivateType *)GifFile->Private;
+    Private->LiteralCodes = Literal;
+
+    /* Only used by EGifSetupCompress() to find the code size */
+    GifFile->SColorMap = (ColorMapObject *)ColorMap;
+    GifFile->Image.Width = Width;
+    GifFile->Image.Height = Height;
+    GifFile->Image.Interlace = Interlace;
+    Private->FileState |= FILE_STATE_SCREEN | FILE_STATE_IMAGE;
+    Private->PixelCount = (long)Width * (long)Height;
+
+    if (EGifSetupCompress(GifFile) == GIF_ERROR)
+        ErrorCode = GifFile->Error;
+    else if (Interlace) {
+	/* Same passes as in EGifSpew() */
+	int InterlacedOffset[] = { 0, 4, 2, 1 };
+	int InterlacedJumps[] = { 8, 8, 4, 2 };
+	int k;
+	for (k = 0; k < 4 && ErrorCode == E_GIF_SUCCEEDED; k++)
+	    for (j = InterlacedOffset[k]; j < Height; j += InterlacedJumps[k])
+		if (EGifPutLine(GifFile, RasterBits + j * Width,
+				Width) == GIF_ERROR) {
+		    ErrorCode = GifFile->Error;
+		    break;
+		}
+    } else {
+	for (j = 0; j < Height; j++)
+	    if (EGifPutLine(GifFile, RasterBits + j * Width,
+			    Width) == GIF_ERROR) {
+		ErrorCode = GifFile->Error;
+		break;
+	    }
+    }
+
+    /* Not EGifCloseFile(): no terminator, and ColorMap is not ours */
+    _FreeCodeTable(Private->CodeTable);
+    free((char *)Private);
+    free(GifFile);
+
+    if (ErrorCode != E_GIF_SUCCEEDED) {
+        free(Out.Data);
+        if (Error != NULL)
+            *Error = ErrorCode;
+        return GIF_ERROR;
+    }
+
+    *Buffer = Out.Data;
+    *Length = Out.Length;
+    if (Error != NULL)
+        *Error = E_GIF_SUCCEEDED;
+    return GIF_OK;
+}
+
+/******************************************************************************
+ Same as EGifSpew(), but the images are already compressed: ImageData[i]
+ holds what EGifEncodeImage() returned for SavedImages[i] (whose RasterBits
+ are not used). Images with a NULL ImageData are not written.
+******************************************************************************/
+int
+EGifSpewEncoded(GifFileType *GifFileOut, GifByteType **ImageData,
+                const size_t *ImageDataLength)
+{
+    int i;
+
+    if (EGifPutScreenDesc(GifFileOut,
+                          GifFileOut->SWidth,
+                          GifFileOut->SHeight,
+                          GifFileOut->SColorResolution,
+                          GifFileOut->SBackGroundColor,
+                          GifFileOut->SColorMap) == GIF_ERROR) {
+        return (GIF_ERROR);
+    }
+
+    for (i = 0; i < GifFileOut->ImageCount; i++) {
+        if (ImageData[i] == NULL)
+            continue;
+        if (EGifPutEncodedImage(GifFileOut, &GifFileOut->SavedImages[i],
+                                ImageData[i], ImageDataLength[i]) == GIF_ERROR)
+            return (GIF_ERROR);
+    }
+
+    return EGifSpewClose(GifFileOut);
+}
+
+/******************************************************************************
+ Write one image compressed by EGifEncodeImage(): its extensions, its
+ descriptor and ImageData. Along with EGifPutScreenDesc() and
+ EGifSpewClose(), this lets a GIF be written one image at a time, as soon
+ as each one is ready, instead of all at once by EGifSpewEncoded().
+******************************************************************************/
+int
+EGifPutEncodedImage(GifFileType *GifFileOut, const SavedImage *Image,
+                    const GifByteType *ImageData, const size_t ImageDataLength)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFileOut->Private;
+
+    if (EGifWriteExtensions(GifFileOut, 
+			    Image->ExtensionBlocks,
+			    Image->ExtensionBlockCount) == GIF_ERROR)
+	return (GIF_ERROR);
+
+    /* This also writes the code size, which starts ImageData */
+    if (EGifPutImageDesc(GifFileOut,
+                         Image->ImageDesc.Left,
+                         Image->ImageDesc.Top,
+                         Image->ImageDesc.Width,
+                         Image->ImageDesc.Height,
+                         Image->ImageDesc.Interlace,
+                         Image->ImageDesc.ColorMap) == GIF_ERROR)
+        return (GIF_ERROR);
+    if (ImageDataLength < 2 || ImageData[0] != Private->BitsPerPixel) {
+        GifFileOut->Error = E_GIF_ERR_DATA_TOO_BIG;
+        return (GIF_ERROR);
+    }
+
+    if (InternalWrite(GifFileOut, ImageData + 1, ImageDataLength - 1)
+            != ImageDataLength - 1) {
+        GifFileOut->Error = E_GIF_ERR_WRITE_FAILED;
+        return (GIF_ERROR);
+    }
+    Private->PixelCount = 0;
+
+    return (GIF_OK);
+}
+
+/******************************************************************************
+ End of EGifSpew(): write the extensions past the last image (ExtensionBlocks)
+ and close the file.
+******************************************************************************/
+int
+EGifSpewClose(GifFileType *GifFileOut)
+{
+    if (EGifWriteExtensions(GifFileOut,
+			    GifFileOut->ExtensionBlocks,
+			    GifFileOut->ExtensionBlockCount) == GIF_ERROR)
+	return (GIF_ERROR);
+
+    if (EGifCloseFile(GifFileOut, NULL) == GIF_ERROR)
+        return (GIF_ERROR);
+
+    return (GIF_OK);
+}
+
 /* end */
@@ -6,6 +6,8 @@ gif_hash.c -- module to support the following operations:
 2. ClearHashTable - clear the hash table to an empty state.
 2. InsertHashTable - insert one item into data structure.
 3. ExistsHashTable - test if item exists in data structure.
+4. InitCodeTable/ClearCodeTable/FreeCodeTable - the direct dictionary
+   the encoder uses instead (lookups and inserts are inline, in gif_hash.h).
 
 This module is used to hash the GIF codes during encoding.
 
@@ -116,6 +118,104 @@ static int KeyItem(uint32_t Item)
     return ((Item >> 12) ^ Item) & HT_KEY_MASK;
 }
 
+/******************************************************************************
+ Allocate an empty code table. Entries (or the hash table) are only	      *
+ allocated by the first clear, when the number of bits per pixel is known.  *
+******************************************************************************/
+GifCodeTableType *_InitCodeTable(void)
+{
+    GifCodeTableType *CodeTable;
+
+    if ((CodeTable = (GifCodeTableType *) malloc(sizeof(GifCodeTableType)))
+	== NULL)
+	return NULL;
+
+    CodeTable -> Entries = NULL;
+    CodeTable -> PixelBits = 0;
+    CodeTable -> RowBits = 0;
+    CodeTable -> Generation = 0;
+    CodeTable -> HashTable = NULL;
+    CodeTable -> RunCodes = NULL;
+    CodeTable -> RunBits = 0;
+
+    return CodeTable;
+}
+
+/******************************************************************************
+ Empty the code table for pixels of PixelBits bits. In a direct table,      *
+ entries of previous generations are ignored, so they are only reset when  *
+ the generation counter wraps or when the rows have to grow.		      *
+ Returns GIF_ERROR if the table can't be allocated.			      *
+******************************************************************************/
+int _ClearCodeTable(GifCodeTableType *CodeTable, int PixelBits)
+{
+    int Pixel;
+
+    /* Only the runs of length 1 (the pixels) are left. */
+    if (CodeTable -> RunCodes == NULL || PixelBits > CodeTable -> RunBits) {
+	free(CodeTable -> RunCodes);
+	CodeTable -> RunCodes = (uint16_t *)
+	    malloc(((size_t) 1 << (PixelBits + 12)) * sizeof(uint16_t));
+	if (CodeTable -> RunCodes == NULL) {
+	    CodeTable -> RunBits = 0;
+	    return GIF_ERROR;
+	}
+	CodeTable -> RunBits = PixelBits;
+    }
+    for (Pixel = 0; Pixel < (1 << PixelBits); Pixel++) {
+	CodeTable -> RunLength[Pixel] = 1;
+	CodeTable -> RunPixel[Pixel] = Pixel;
+	CodeTable -> RunCount[Pixel] = 1;
+	CT_RUN_CODE(CodeTable, Pixel, 1) = Pixel;
+    }
+
+    if (PixelBits > CT_MAX_DIRECT_BITS) {
+	if (CodeTable -> HashTable == NULL) {
+	    if ((CodeTable -> HashTable = _InitHashTable()) == NULL)
+		return GIF_ERROR;
+	} else
+	    _ClearHashTable(CodeTable -> HashTable);
+	CodeTable -> RowBits = 0;
+	return GIF_OK;
+    }
+
+    if (CodeTable -> Entries == NULL || PixelBits > CodeTable -> PixelBits) {
+	/* Zero entries belong to generation 0, which is never used. */
+	free(CodeTable -> Entries);
+	CodeTable -> Entries = (uint32_t *)
+	    calloc((size_t) (HT_MAX_CODE + 1) << PixelBits, sizeof(uint32_t));
+	if (CodeTable -> Entries == NULL) {
+	    CodeTable -> PixelBits = 0;
+	    return GIF_ERROR;
+	}
+	CodeTable -> PixelBits = PixelBits;
+	CodeTable -> Generation = 0;
+    }
+
+    if (++CodeTable -> Generation > CT_MAX_GEN) {
+	memset(CodeTable -> Entries, 0,
+	       ((size_t) (HT_MAX_CODE + 1) << CodeTable -> PixelBits)
+	       * sizeof(uint32_t));
+	CodeTable -> Generation = 1;
+    }
+    CodeTable -> RowBits = PixelBits;
+
+    return GIF_OK;
+}
+
+/******************************************************************************
+ Free a code table and its entries.					      *
+******************************************************************************/
+void _FreeCodeTable(GifCodeTableType *CodeTable)
+{
+    if (CodeTable == NULL)
+	return;
+    free(CodeTable -> Entries);
+    free(CodeTable -> HashTable);
+    free(CodeTable -> RunCodes);
+    free(CodeTable);
+}
+
 #ifdef	DEBUG_HIT_RATE
 /******************************************************************************
  Debugging routine to print the hit ratio - number of times the hash table   *
@@ -9,9 +9,13 @@
 #include <string.h>
 
 #include "gif_lib.h"
+#include "gif_lib_private.h"
 
 #define MAX(x, y)    (((x) > (y)) ? (x) : (y))
 
+#define ARENA_FIRST_CHUNK    4096
+#define ARENA_ALIGN          16    /* Enough for any field of a block. */
+
 /******************************************************************************
  Miscellaneous utility functions                          
 ******************************************************************************/
@@ -217,6 +221,66 @@ GifApplyTranslation(SavedImage *Image, GifPixelType Translation[])
         Image->RasterBits[i] = Translation[Image->RasterBits[i]];
 }
 
+/******************************************************************************
+ Room for one more element in Array, which has Count of them: its capacity
+ is the smallest power of 2 >= Count, so it only grows when Count gets to a
+ power of 2 and appending n elements costs O(n) copies. Only for arrays
+ grown by this function. Returns NULL (Array left as is) if out of memory.
+******************************************************************************/
+void *
+GifGrowArray(void *Array, int Count, size_t Size)
+{
+    if (Array != NULL && Count > 0 && (Count & (Count - 1)) != 0)
+        return Array;
+
+    return reallocarray(Array, Count > 0 ? 2 * (size_t)Count : 1, Size);
+}
+
+/******************************************************************************
+ Arena allocator: Size bytes (aligned on Align, a power of 2) taken from the
+ last chunk of *Arena, a new chunk being added when it is full. Chunks double
+ in size so there are only a few of them, and nothing is freed before
+ GifArenaFree(), which frees every chunk at once.
+******************************************************************************/
+void *
+GifArenaAlloc(GifArenaChunk **Arena, size_t Size, size_t Align)
+{
+    GifArenaChunk *Chunk = *Arena;
+    size_t Header = (sizeof(GifArenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    size_t Start = 0;
+
+    if (Chunk != NULL)
+        Start = (Chunk->Used + Align - 1) & ~(Align - 1);
+
+    if (Chunk == NULL || Start + Size > Chunk->Size) {
+        size_t ChunkSize = (Chunk != NULL) ? 2 * Chunk->Size : ARENA_FIRST_CHUNK;
+
+        while (ChunkSize < Size)
+            ChunkSize *= 2;
+        Chunk = (GifArenaChunk *)malloc(Header + ChunkSize);
+        if (Chunk == NULL)
+            return NULL;
+        Chunk->Next = *Arena;
+        Chunk->Size = ChunkSize;
+        *Arena = Chunk;
+        Start = 0;
+    }
+
+    Chunk->Used = Start + Size;
+    return (char *)Chunk + Header + Start;
+}
+
+void
+GifArenaFree(GifArenaChunk **Arena)
+{
+    while (*Arena != NULL) {
+        GifArenaChunk *Next = (*Arena)->Next;
+
+        free(*Arena);
+        *Arena = Next;
+    }
+}
+
 /******************************************************************************
  Extension record functions                              
 ******************************************************************************/
@@ -228,20 +292,12 @@ GifAddExtensionBlock(int *ExtensionBlockCount,
 		     unsigned char ExtData[])
 {
     ExtensionBlock *ep;
+    ExtensionBlock *ep_new = (ExtensionBlock *)GifGrowArray(*ExtensionBlocks,
+                                  *ExtensionBlockCount, sizeof(ExtensionBlock));
 
-    if (*ExtensionBlocks == NULL)
-        *ExtensionBlocks=(ExtensionBlock *)malloc(sizeof(ExtensionBlock));
-    else {
-        ExtensionBlock* ep_new = (ExtensionBlock *)reallocarray
-				 (*ExtensionBlocks, (*ExtensionBlockCount + 1),
-                                      sizeof(ExtensionBlock));
-        if( ep_new == NULL )
-            return (GIF_ERROR);
-        *ExtensionBlocks = ep_new;
-    }
-
-    if (*ExtensionBlocks == NULL)
+    if (ep_new == NULL)
         return (GIF_ERROR);
+    *ExtensionBlocks = ep_new;
 
     ep = &(*ExtensionBlocks)[(*ExtensionBlockCount)++];
 
@@ -258,6 +314,65 @@ GifAddExtensionBlock(int *ExtensionBlockCount,
     return (GIF_OK);
 }
 
+/******************************************************************************
+ Same as GifAddExtensionBlock(), but the blocks and their data are taken from
+ *Arena (the array is copied when it grows, the old one is only freed with
+ the arena). If Arena is NULL, it is GifAddExtensionBlock(). The blocks must
+ then never be given to GifFreeExtensions().
+******************************************************************************/
+int
+GifArenaAddExtensionBlock(GifArenaChunk **Arena,
+                          int *ExtensionBlockCount,
+                          ExtensionBlock **ExtensionBlocks,
+                          int Function,
+                          unsigned int Len,
+                          unsigned char ExtData[])
+{
+    ExtensionBlock *ep;
+    int Count = *ExtensionBlockCount;
+
+    if (Arena == NULL)
+        return GifAddExtensionBlock(ExtensionBlockCount, ExtensionBlocks,
+                                    Function, Len, ExtData);
+
+    /* Same capacity as GifGrowArray() */
+    if (*ExtensionBlocks == NULL || Count == 0 || (Count & (Count - 1)) == 0) {
+        ExtensionBlock *ep_new = (ExtensionBlock *)GifArenaAlloc(Arena,
+                                      (Count > 0 ? 2 * (size_t)Count : 1) * sizeof(ExtensionBlock),
+                                      ARENA_ALIGN);
+        if (ep_new == NULL)
+            return (GIF_ERROR);
+        if (Count > 0)
+            memcpy(ep_new, *ExtensionBlocks, Count * sizeof(ExtensionBlock));
+        *ExtensionBlocks = ep_new;
+    }
+
+    ep = &(*ExtensionBlocks)[Count];
+    ep->Function = Function;
+    ep->ByteCount = Len;
+    ep->Bytes = (GifByteType *)GifArenaAlloc(Arena, Len, 1);
+    if (ep->Bytes == NULL)
+        return (GIF_ERROR);
+
+    if (ExtData != NULL) {
+        memcpy(ep->Bytes, ExtData, Len);
+    }
+    (*ExtensionBlockCount)++;
+
+    return (GIF_OK);
+}
+
+/* Arena of the extension blocks of GifFile, NULL if they are on the heap */
+static GifArenaChunk **
+ExtensionArena(GifFileType *GifFile)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *)GifFile->Private;
+
+    if (Private == NULL || Private->Arena == NULL)
+        return NULL;
+    return &Private->Arena;
+}
+
 void
 GifFreeExtensions(int *ExtensionBlockCount,
 		  ExtensionBlock **ExtensionBlocks)
@@ -305,8 +420,11 @@ FreeLastSavedImage(GifFileType *GifFile)
     if (sp->RasterBits != NULL)
         free((char *)sp->RasterBits);
 
-    /* Deallocate any extensions */
-    GifFreeExtensions(&sp->ExtensionBlockCount, &sp->ExtensionBlocks);
+    /* Deallocate any extensions (the ones in an arena go with it) */
+    if (ExtensionArena(GifFile) == NULL)
+        GifFreeExtensions(&sp->ExtensionBlockCount, &sp->ExtensionBlocks);
+    sp->ExtensionBlocks = NULL;
+    sp->ExtensionBlockCount = 0;
 
     /*** FIXME: We could realloc the GifFile->SavedImages structure but is
      * there a point to it? Saves some memory but we'd have to do it every
@@ -322,43 +440,54 @@ FreeLastSavedImage(GifFileType *GifFile)
 SavedImage *
 GifMakeSavedImage(GifFileType *GifFile, const SavedImage *CopyFrom)
 {
-    if (GifFile->SavedImages == NULL)
-        GifFile->SavedImages = (SavedImage *)malloc(sizeof(SavedImage));
-    else
-        GifFile->SavedImages = (SavedImage *)reallocarray(GifFile->SavedImages,
-                               (GifFile->ImageCount + 1), sizeof(SavedImage));
+    SavedImage *sp, *NewImages;
+    SavedImage Copy;
+
+    /* CopyFrom may be in SavedImages, which can move */
+    if (CopyFrom != NULL) {
+        Copy = *CopyFrom;
+        CopyFrom = &Copy;
+    }
 
-    if (GifFile->SavedImages == NULL)
+    /* SavedImages is still valid (and not leaked) if this fails */
+    NewImages = (SavedImage *)GifGrowArray(GifFile->SavedImages,
+                                GifFile->ImageCount, sizeof(SavedImage));
+    if (NewImages == NULL)
         return ((SavedImage *)NULL);
-    else {
-        SavedImage *sp = &GifFile->SavedImages[GifFile->ImageCount++];
-        memset((char *)sp, '\0', sizeof(SavedImage));
-
-        if (CopyFrom != NULL) {
-            memcpy((char *)sp, CopyFrom, sizeof(SavedImage));
-
-            /* 
-             * Make our own allocated copies of the heap fields in the
-             * copied record.  This guards against potential aliasing
-             * problems.
-             */
-
-            /* first, the local color map */
-            if (sp->ImageDesc.ColorMap != NULL) {
-                sp->ImageDesc.ColorMap = GifMakeMapObject(
-                                         CopyFrom->ImageDesc.ColorMap->ColorCount,
-                                         CopyFrom->ImageDesc.ColorMap->Colors);
-                if (sp->ImageDesc.ColorMap == NULL) {
-                    FreeLastSavedImage(GifFile);
-                    return (SavedImage *)(NULL);
-                }
+    GifFile->SavedImages = NewImages;
+
+    sp = &GifFile->SavedImages[GifFile->ImageCount++];
+    memset((char *)sp, '\0', sizeof(SavedImage));
+
+    if (CopyFrom != NULL) {
+        int i;
+
+        /* 
+         * Make our own allocated copies of the heap fields in the
+         * copied record.  This guards against potential aliasing
+         * problems. None of them is shared until it is copied, so that
+         * FreeLastSavedImage() never frees the ones of CopyFrom.
+         */
+        sp->ImageDesc = CopyFrom->ImageDesc;
+        sp->ImageDesc.ColorMap = NULL;
+
+        /* first, the local color map */
+        if (CopyFrom->ImageDesc.ColorMap != NULL) {
+            sp->ImageDesc.ColorMap = GifMakeMapObject(
+                                     CopyFrom->ImageDesc.ColorMap->ColorCount,
+                                     CopyFrom->ImageDesc.ColorMap->Colors);
+            if (sp->ImageDesc.ColorMap == NULL) {
+                FreeLastSavedImage(GifFile);
+                return (SavedImage *)(NULL);
             }
+        }
 
-            /* next, the raster */
+        /* next, the raster (if it was read) */
+        if (CopyFrom->RasterBits != NULL) {
             sp->RasterBits = (unsigned char *)reallocarray(NULL,
                                                   (CopyFrom->ImageDesc.Height *
                                                   CopyFrom->ImageDesc.Width),
-						  sizeof(GifPixelType));
+                                                  sizeof(GifPixelType));
             if (sp->RasterBits == NULL) {
                 FreeLastSavedImage(GifFile);
                 return (SavedImage *)(NULL);
@@ -366,23 +495,24 @@ GifMakeSavedImage(GifFileType *GifFile, const SavedImage *CopyFrom)
             memcpy(sp->RasterBits, CopyFrom->RasterBits,
                    sizeof(GifPixelType) * CopyFrom->ImageDesc.Height *
                    CopyFrom->ImageDesc.Width);
+        }
+
+        /* finally, the extension blocks, with their own data */
+        for (i = 0; i < CopyFrom->ExtensionBlockCount; i++) {
+            ExtensionBlock *ep = &CopyFrom->ExtensionBlocks[i];
 
-            /* finally, the extension blocks */
-            if (sp->ExtensionBlocks != NULL) {
-                sp->ExtensionBlocks = (ExtensionBlock *)reallocarray(NULL,
-                                      CopyFrom->ExtensionBlockCount,
-				      sizeof(ExtensionBlock));
-                if (sp->ExtensionBlocks == NULL) {
-                    FreeLastSavedImage(GifFile);
-                    return (SavedImage *)(NULL);
-                }
-                memcpy(sp->ExtensionBlocks, CopyFrom->ExtensionBlocks,
-                       sizeof(ExtensionBlock) * CopyFrom->ExtensionBlockCount);
+            if (GifArenaAddExtensionBlock(ExtensionArena(GifFile),
+                                          &sp->ExtensionBlockCount,
+                                          &sp->ExtensionBlocks,
+                                          ep->Function, ep->ByteCount,
+                                          ep->Bytes) == GIF_ERROR) {
+                FreeLastSavedImage(GifFile);
+                return (SavedImage *)(NULL);
             }
         }
-
-        return (sp);
     }
+
+    return (sp);
 }
 
 void
@@ -403,7 +533,10 @@ GifFreeSavedImages(GifFileType *GifFile)
         if (sp->RasterBits != NULL)
             free((char *)sp->RasterBits);
 	
-	GifFreeExtensions(&sp->ExtensionBlockCount, &sp->ExtensionBlocks);
+	if (ExtensionArena(GifFile) == NULL)
+	    GifFreeExtensions(&sp->ExtensionBlockCount, &sp->ExtensionBlocks);
+	sp->ExtensionBlocks = NULL;
+	sp->ExtensionBlockCount = 0;
     }
     free((char *)GifFile->SavedImages);
     GifFile->SavedImages = NULL;
@@ -21,6 +21,8 @@
 #define SIZE_STENCIL 5
 
 int USE_GPU = 0;
+int tile_cache = 1; // 1 if a process filtering whole frames one after the other only filters again what changed
+int show_heuristics = 1; // 0 while filtering window by window: filter_frames_windowed prints them once for all the frames
 int PROCCESS_LIMIT = 6;
 
 /****************************************************************************************************************************************************/
@@ -34,8 +36,18 @@ typedef struct img_info
     int image; // image # 
     int ghost_cells_right, n_columns, ghost_cells_left, width ; // number of pixels in a width of a part
     int rank, rank_left, rank_right;
+    int owner, round; // rank in the communicator working on this part, round in which it is processed
+    int first_column; // column of the image where the part begins (without ghost cells)
 } img_info;
 
+typedef struct encoded_frames
+{
+    ColorMapObject *cmo; // colormap of the output (NULL if the frames were not encoded)
+    GifByteType **data; // compressed data of each frame, as written after its image descriptor
+    size_t *length;
+    int literal; // 1 to store the pixels as literal codes (no LZW), set by the root
+} encoded_frames;
+
 
 /*********************************************************** STRUCTURES TO HANDLE MANY PARTS OF IMG ****************************************************/
 
@@ -61,6 +73,7 @@ void fill_info_part_for_one_image(img_info info_array[],int n_parts, int parts_d
         info_array[part_global_num].order = part_global_num;
         info_array[part_global_num].order_sub_img = k;
         info_array[part_global_num].image = img_n;
+        info_array[part_global_num].first_column = k * standard_n_columns;
 
         // OTHER PROCESS INFO
         info_array[part_global_num].rank = k;
@@ -121,6 +134,34 @@ void fill_tables(img_info info_array[], pixel* pixel_array[], MPI_Datatype datat
     }
 }
 
+void fill_schedule(img_info info_array[], int n_total_parts, int n_process, int root_work){
+    // Each round gives one part to every process: root (if it works) takes the first one, then ranks in order
+    int k;
+    for (k = 0; k < n_total_parts; k++){
+        info_array[k].round = k / n_process;
+        info_array[k].owner = k % n_process + (1 - root_work);
+    }
+}
+
+void decode_part(GifFileType *decoder, GifFrameIndex *frame, img_info info, pixel *pixel_part){ // Decode the frame of a part from the file, and keep the columns of the part (with ghost cells)
+    pixel *frame_pixel = (pixel *)malloc(frame->Width * frame->Height * sizeof(pixel));
+    if ( !decode_pixels(decoder, frame, frame_pixel) )
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    copy_rows_to_columns(frame_pixel + info.first_column - info.ghost_cells_left, frame->Width, info.width, info.height, pixel_part);
+    free(frame_pixel);
+}
+
+int image_owner(img_info info_array[], int part){ // Process which assembles and encodes the image of a part (the owner of its first part)
+    return info_array[part - info_array[part].order_sub_img].owner;
+}
+
+int image_width(img_info info_array[], int n_total_parts, int first_part){ // Width of an image, from the last of its parts
+    int k = first_part;
+    while (k + 1 < n_total_parts && info_array[k + 1].image == info_array[first_part].image)
+        k++;
+    return info_array[k].first_column + info_array[k].n_columns;
+}
+
 
 /***************************************************************** WORKERS ******************************************************************************/
 
@@ -278,6 +319,34 @@ void call_worker_solo(MPI_Comm local_comm, img_info info_recv, pixel *pixel_recv
 }
 
 
+void call_worker_in_place(int width, int height, pixel *p, int rank, filter_cache *cache, unsigned char *transparent){ // Function to handle a whole frame stored by rows, in place and without communication
+    // If cache is not NULL, only what changed since the previous frame given with it is filtered again (on the CPU)
+    // If transparent is not NULL, the regions only made of transparent pixels are skipped (on the CPU)
+    if (USE_GPU || (double)(height * width) > 1000000){
+        // The GPU kernel works by columns: go through the usual worker on a transposed frame
+        img_info info_frame;
+        memset(&info_frame, 0, sizeof(img_info));
+        info_frame.height = height;
+        info_frame.width = width;
+        info_frame.n_columns = width;
+        info_frame.rank_left = -1;
+        info_frame.rank_right = -1;
+
+        pixel *pixel_col = (pixel *)malloc(width * height * sizeof( pixel ) );
+        copy_rows_to_columns(p, width, width, height, pixel_col);
+        call_worker(MPI_COMM_SELF, info_frame, pixel_col, rank);
+        copy_columns_to_rows(pixel_col, width, height, p, width);
+        free(pixel_col);
+    } else if (cache != NULL){
+        apply_filters_one_frame_cached(width, height, p, SIZE_STENCIL, 20, cache, transparent);
+    } else if (transparent != NULL){
+        apply_filters_one_frame_transparent(width, height, p, SIZE_STENCIL, 20, transparent);
+    } else {
+        apply_filters_one_frame(width, height, p, SIZE_STENCIL, 20);
+    }
+}
+
+
 /***************************************************************** HEURISTICS ******************************************************************************/
 
 void get_first_heuristics(int *n_rounds, int *n_parts_per_img, int n_process, int n_images){ // First draw of heuristics
@@ -340,86 +409,249 @@ void set_optimal_parameters(int *n_process, int *num_threads, int *reduced_proce
     }
 }
 
-/******************************************************************* MAIN **********************************************************************************/
+/*************************************************************** PERFORMANCES ****************************************************************************/
 
-int main( int argc, char ** argv ){
+void save_performance(char *perf_filename, struct timeval t11, struct timeval t12, int n_process, int num_threads, int nodes, char *input_filename, int n_images, int width, int height, int beta, int root_work, int has_used_gpu){
+    FILE *filetow = fopen(perf_filename, "a");
+    double duration = (t12.tv_sec-t11.tv_sec)+((t12.tv_usec-t11.tv_usec)/1e6);
+    char *name = input_filename;
+    fprintf(filetow, "time: %lf; process: %d; threads: %d; node: %d; image: %s; n_images: %d; w: %d; h: %d; beta: %d; root_work: %d; gpu: %d; \n", duration, n_process, num_threads, nodes, name, n_images, width, height,beta, root_work, has_used_gpu) ;
+    fclose(filetow);
+}
 
-    /* -------------------- MPI_INIT AND THREAD INIT -------------------- */ 
-    int n_process, rank;
-    int thread_priority_given, thread_priority_asked = 2;
+/*************************************************************** DISTRIBUTED ENCODE ************************************************************************/
+
+int frame_colors(pixel *frame, int n_pixels, pixel *colors, unsigned short *lut){ // Colors of a frame in order of first appearance (at most 256), lut is left empty for the next frame
+    GifColorType list[256];
+    int k, n_colors = add_pixel_colors(list, 0, frame, n_pixels, lut);
+    if (n_colors < 0)
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    clear_color_lut(lut, list, n_colors);
+    for (k = 0; k < n_colors; k++){
+        colors[k].r = list[k].Red;
+        colors[k].g = list[k].Green;
+        colors[k].b = list[k].Blue;
+    }
+    return n_colors;
+}
 
-    MPI_Init_thread(&argc, &argv, thread_priority_asked, &thread_priority_given);
-    MPI_Comm_size(MPI_COMM_WORLD, &n_process);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+void set_local_colormap(SavedImage *frame, ColorMapObject *local, int transparent){ // Colormap chosen by make_local_colormap (NULL: the global one)
+    ExtensionBlock *gce = frame_transparency(frame);
+    frame->ImageDesc.ColorMap = local;
+    if (gce != NULL)
+        gce->Bytes[3] = transparent;
+}
 
-    int num_threads = 1;
+void encode_frames(MPI_Comm comm, MPI_Comm red_comm, img_info parts_info[], int n_total_parts, pixel *frames[], animated_gif *image, encoded_frames *encoded){
+    // Every process compresses the frames it owns (frames[i] != NULL) and sends them to rank 0 of comm, which only has to write them
+    // The colormap is the one store_pixels would build: merging the colors of each frame in frame order gives the same order
+    int rank, i, k;
+    MPI_Comm_rank(comm, &rank);
+
+    int n_images = parts_info[n_total_parts - 1].image + 1;
+    int tag_colors = n_total_parts, tag_data = n_total_parts + n_images, tag_cmap = n_total_parts + 2 * n_images; // after the tags of the parts
+    pixel colors[256];
+    int n_colors;
+    ColorMapObject *cmo = NULL;
+    unsigned short *lut = new_color_lut(); // one lookup table for all my frames (32 MB)
+    if (lut == NULL)
+        MPI_Abort(MPI_COMM_WORLD, 1);
+
+    // Colors of each frame, merged by the root
+    if (rank == 0){
+        GifColorType *colormap = (GifColorType *)malloc(256 * sizeof(GifColorType));
+        unsigned short *merge_lut = new_color_lut(); // colors of colormap, while lut is the one of each frame
+        n_colors = init_output_colormap(image, colormap);
+        if (n_colors == 0 || merge_lut == NULL)
+            MPI_Abort(MPI_COMM_WORLD, 1);
+
+        for (k = 0; k < n_total_parts; k++){
+            if (parts_info[k].order_sub_img != 0)
+                continue;
+            i = parts_info[k].image;
+            int n_frame_colors;
+            if (frames[i] != NULL)
+                n_frame_colors = frame_colors(frames[i], image->width[i] * image->height[i], colors, lut);
+            else {
+                MPI_Status status;
+                MPI_Recv(colors, 256 * 3, MPI_INT, parts_info[k].owner, tag_colors + i, comm, &status);
+                MPI_Get_count(&status, MPI_INT, &n_frame_colors);
+                n_frame_colors /= 3;
+            }
+            n_colors = add_pixel_colors(colormap, n_colors, colors, n_frame_colors, merge_lut);
+            if (n_colors < 0)
+                MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        free(merge_lut);
 
-    #ifdef _OPENMP
-        #pragma omp parallel
-        {
-            num_threads = omp_get_num_threads();
+        cmo = make_output_colormap(colormap, n_colors);
+        if (cmo == NULL)
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        free(colormap);
+        n_colors = cmo->ColorCount;
+    } else {
+        for (k = 0; k < n_total_parts; k++){
+            i = parts_info[k].image;
+            if (parts_info[k].order_sub_img != 0 || frames[i] == NULL)
+                continue;
+            int n_frame_colors = frame_colors(frames[i], parts_info[k].height * image_width(parts_info, n_total_parts, k), colors, lut);
+            MPI_Send(colors, n_frame_colors * 3, MPI_INT, 0, tag_colors + i, comm);
         }
-    #endif
+    }
 
-    /* -------------------- VARIABLES FOR OPTIONS -------------------- */
+    // Share the colormap, the interlace flags and the transparent colors (-1 if none)
+    int interlace[n_images], transparent[n_images];
+    MPI_Bcast(&n_colors, 1, MPI_INT, 0, red_comm);
+    if (rank != 0)
+        cmo = GifMakeMapObject(n_colors, NULL);
+    MPI_Bcast(cmo->Colors, n_colors * sizeof(GifColorType), MPI_BYTE, 0, red_comm);
+    if (rank == 0)
+        for (i = 0; i < n_images; i++){
+            ExtensionBlock *gce = frame_transparency(&image->g->SavedImages[i]);
+            interlace[i] = image->g->SavedImages[i].ImageDesc.Interlace;
+            transparent[i] = gce ? gce->Bytes[3] : -1;
+        }
+    MPI_Bcast(interlace, n_images, MPI_INT, 0, red_comm);
+    MPI_Bcast(transparent, n_images, MPI_INT, 0, red_comm);
+    int literal = (rank == 0) ? encoded->literal : 0;
+    MPI_Bcast(&literal, 1, MPI_INT, 0, red_comm);
+
+    // Compress my frames (the lookup table of the colors of each frame now gives their index in cmo)
+    free(lut);
+    lut = colormap_lut(cmo);
+    if (lut == NULL)
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    for (k = 0; k < n_total_parts; k++){
+        i = parts_info[k].image;
+        if (parts_info[k].order_sub_img != 0 || frames[i] == NULL)
+            continue;
+        int width = image_width(parts_info, n_total_parts, k);
+        int height = parts_info[k].height;
+        GifByteType *data, *raster = (GifByteType *)malloc(width * height * sizeof(GifByteType));
+        size_t length;
+        int error;
+
+        if (!map_pixels_to_colormap(lut, frames[i], width * height, raster))
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        ColorMapObject *local = make_local_colormap(cmo, raster, width * height, &transparent[i]); // same choice as store_pixels
+        if (EGifEncodeImage(local ? local : cmo, width, height, interlace[i], literal, raster, &data, &length, &error) == GIF_ERROR){
+            fprintf(stderr, "Error EGifEncodeImage: <%s>\n", GifErrorString(error));
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        free(raster);
+
+        if (rank == 0){
+            encoded->data[i] = data;
+            encoded->length[i] = length;
+            set_local_colormap(&image->g->SavedImages[i], local, transparent[i]);
+        } else {
+            int header[2] = {local ? local->ColorCount : 0, transparent[i]};
+            MPI_Send(header, 2, MPI_INT, 0, tag_cmap + i, comm);
+            if (local){
+                MPI_Send(local->Colors, local->ColorCount * sizeof(GifColorType), MPI_BYTE, 0, tag_cmap + i, comm);
+                GifFreeMapObject(local);
+            }
+            MPI_Send(data, length, MPI_BYTE, 0, tag_data + i, comm);
+            free(data);
+        }
+    }
+    free(lut);
+
+    // The root gathers the compressed frames
+    if (rank == 0){
+        for (k = 0; k < n_total_parts; k++){
+            i = parts_info[k].image;
+            if (parts_info[k].order_sub_img != 0 || frames[i] != NULL)
+                continue;
+            MPI_Status status;
+            int length, header[2];
+            ColorMapObject *local = NULL;
+            MPI_Recv(header, 2, MPI_INT, parts_info[k].owner, tag_cmap + i, comm, MPI_STATUS_IGNORE);
+            if (header[0] > 0){
+                local = GifMakeMapObject(header[0], NULL);
+                MPI_Recv(local->Colors, header[0] * sizeof(GifColorType), MPI_BYTE, parts_info[k].owner, tag_cmap + i, comm, MPI_STATUS_IGNORE);
+            }
+            set_local_colormap(&image->g->SavedImages[i], local, header[1]);
 
-    int is_file_performance = 0; // to save the result in a file
-    char * perf_filename ;
-    int beta  = 1; // choose if you want to limitate the number of parts of image (1) or not (0)
-    int root_work = 1; // to set if you want that the root process work (1) or not (0)
+            MPI_Probe(parts_info[k].owner, tag_data + i, comm, &status);
+            MPI_Get_count(&status, MPI_BYTE, &length);
+            encoded->data[i] = (GifByteType *)malloc(length);
+            encoded->length[i] = length;
+            MPI_Recv(encoded->data[i], length, MPI_BYTE, parts_info[k].owner, tag_data + i, comm, MPI_STATUS_IGNORE);
+        }
+        encoded->cmo = cmo;
+    } else
+        GifFreeMapObject(cmo);
+}
 
-    if(argc < 3 || (argc-3)%2 != 0){
-        print_how_to(rank);
-        return 1;
-    }
+/*************************************************************** FILTER THE FRAMES *************************************************************************/
 
-    char *input_filename = argv[1];
-    char *output_filename = argv[2];
+void filter_frames(MPI_Comm comm, animated_gif *image, int n_images, int beta, int num_threads, GifFileType *decoder, GifFrameIndex *index, GifFileType *stream, encoded_frames *encoded, gif_writer *writer, int *n_process_used, int *root_work_used, int *has_used_gpu){
+    // Filter the frames of image (only known by rank 0 of comm) with all the process of comm, and put the result back in image
+    // If decoder is not NULL, every process decodes its parts from the file (using index) instead of receiving them from rank 0
+    // If stream is not NULL, the frames of image are not decoded yet: rank 0 decodes them in order from it, each one right before sending its parts
+    // If encoded is not NULL, the owner of the first part of each frame assembles and compresses it, rank 0 gets the result in encoded
+    // (the frames are then not put back in image; encoded->cmo stays NULL if they were filtered in place instead)
+    // If writer is not NULL (and encoded is), rank 0 gives each frame to it as soon as all its parts are back
 
-    int i,j;
-    for (i = 3; i < argc-1; i++){
-        if (strcmp(argv[i], "-file") == 0){
-            is_file_performance = 1;
-            perf_filename = argv[i+1];
-        }
-    }
+    int n_process, rank;
+    MPI_Comm_size(comm, &n_process);
+    MPI_Comm_rank(comm, &rank);
 
-    /* -------------------- FIRST ALLOCATIONS -------------------- */ 
+    int i,j;
 
     // General informations about the image
     int n_int_img_info = sizeof(img_info) / sizeof(int);
-    int n_parts, n_images, n_rounds;
-    int height = 0;
-    int width = 0;
+    int n_parts, n_rounds, n_total_parts;
     int reduced_process = 0;
+    int root_work = 1; // to set if you want that the root process work (1) or not (0)
     MPI_Comm local_comm;
 
     // Struct to be used 
     img_info *parts_info = NULL;
     pixel **parts_pixel = NULL;
     MPI_Datatype *COLUMNS = NULL;
-    animated_gif * image ;
-    struct timeval t11, t12;
 
     set_optimal_parameters(&n_process, &num_threads, &reduced_process, &root_work);
     int root_not_work = 1 - root_work;
 
+    /* -------------------- ONE PROCESS: FILTER THE FRAMES IN PLACE -------------------- */
+    if (n_process == 1){
+        if (rank == 0){
+            // Consecutive frames often only differ in a small region
+            filter_cache cache;
+            init_filter_cache(&cache);
+            for (i = 0; i < n_images; i++){
+                if (decoder != NULL && !decode_pixels(decoder, &index[i], image->p[i]))
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                if (stream != NULL && !decode_next_pixels(stream, image->p[i]))
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                call_worker_in_place(image->width[i], image->height[i], image->p[i], rank, (tile_cache && n_images > 1) ? &cache : NULL, (image->mask != NULL) ? image->mask[i] : NULL);
+                if (writer != NULL && !write_gif_frame(writer, i))
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            free_filter_cache(&cache);
+
+            *n_process_used = n_process;
+            *root_work_used = root_work;
+            *has_used_gpu = ((double)(image->width[0]) * image->height[0] > 1000000) ? 1 : 0;
+            if (encoded != NULL)
+                encoded->cmo = NULL;
+        }
+        return;
+    }
+
     /* -------------------- CHOOSING THE CUTTING STRATEGY -------------------- */ 
     if(rank == 0){
 
         if (root_not_work)
             n_process--;
 
-        // Load image
-        load_image_from_file(&image, &n_images, input_filename);
-        height = image->height[0];
-        width = image->width[0];
-        gettimeofday(&t11, NULL);
-
         // Choose how to split images between process
         int n_parts_per_img[n_images];
         get_heuristics(&n_rounds, &n_parts, n_parts_per_img, n_process,n_images,beta);
-        print_heuristics(n_images, n_process, n_rounds, n_parts_per_img);
+        if (show_heuristics)
+            print_heuristics(n_images, n_process, n_rounds, n_parts_per_img);
 
         // Structures needed for splitting data
         parts_info = (img_info *)malloc(n_parts * n_images * sizeof(img_info));
@@ -428,159 +660,711 @@ int main( int argc, char ** argv ){
 
         // Fill_info_parts and pixel_arts and columns 
         fill_tables(parts_info,parts_pixel,COLUMNS,image,n_parts_per_img, n_images, root_work);
+
+        // Give every part its process and its round
+        n_total_parts = n_rounds * n_process;
+        fill_schedule(parts_info, n_total_parts, n_process, root_work);
     }
 
 
     /* -------------------- CREATING ALL THE DIFFERENT COMMUNICATORS -------------------- */ 
-    MPI_Bcast(&n_parts, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&root_work, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&n_parts, 1, MPI_INT, 0, comm);
+    MPI_Bcast(&root_work, 1, MPI_INT, 0, comm);
 
     int pseudo_rank = (rank == 0 && root_work == 0) ? 1000 : rank - root_not_work;
-    MPI_Comm_split(MPI_COMM_WORLD, pseudo_rank/n_parts, pseudo_rank, &local_comm);
+    MPI_Comm_split(comm, pseudo_rank/n_parts, pseudo_rank, &local_comm);
 
-    /* -------------------- CREATE THE REDUCED MPI_COMM_WORLD --------------------------- */
+    /* -------------------- CREATE THE REDUCED COMMUNICATOR --------------------------- */
     MPI_Comm RED_COMM_WORLD;
-    MPI_Comm_split(MPI_COMM_WORLD, rank/n_process, rank, &RED_COMM_WORLD);
-    
+    MPI_Comm_split(comm, rank/n_process, rank, &RED_COMM_WORLD);
+
+    /* -------------------- BROADCAST THE WHOLE SCHEDULE ONCE --------------------------- */
+    if (rank == 0 || rank < n_process){
+        MPI_Bcast(&n_total_parts, 1, MPI_INT, 0, RED_COMM_WORLD);
+        if (rank != 0)
+            parts_info = (img_info *)malloc(n_total_parts * sizeof(img_info));
+        MPI_Bcast(parts_info, n_total_parts * n_int_img_info, MPI_INT, 0, RED_COMM_WORLD);
+    }
 
 
     /* -------------------- ALGORITHM FOR THE ROOT -------------------- */
     if(rank == 0){
         
         // Initialize
-        int r;
-        MPI_Status status;
-        MPI_Request req;
-        img_info lol;
-
-        // Handle sending if root_work == 0
-        int displs[n_process + root_not_work];
-        int tab_leng[n_process + root_not_work];
-        displs[0] = 0;
-        tab_leng[0] = n_int_img_info;
-        if (n_process + root_not_work>1){
-            if (!root_work){
-                displs[1] = 0;
-            } else {
-                displs[1] = n_int_img_info;
+        MPI_Request *send_reqs = (MPI_Request *)malloc(n_total_parts * sizeof(MPI_Request));
+        MPI_Request *recv_reqs = (MPI_Request *)malloc(n_total_parts * sizeof(MPI_Request));
+        MPI_Request *fwd_reqs = (MPI_Request *)malloc(n_total_parts * sizeof(MPI_Request));
+        pixel **root_pixel = (pixel **)calloc(n_total_parts, sizeof(pixel *));
+        int *recv_part = (int *)malloc(n_total_parts * sizeof(int));
+        int n_sends = 0, n_recvs = 0, n_fwds = 0;
+        int n_decoded = (stream != NULL) ? 0 : n_images;
+
+        // Parts of each frame not back yet, to write the frame when it gets to 0
+        int parts_left[n_images];
+        for (i = 0; i < n_images; i++)
+            parts_left[i] = 0;
+        for (j = 0; j < n_total_parts; j++)
+            parts_left[parts_info[j].image]++;
+
+        // Sending all the parts at once, workers have already posted their receives
+        // (when streaming, the workers start on the first frames while the next ones are decoded)
+        for (j = 0; j < n_total_parts; j++){
+            if (parts_info[j].owner == 0 || decoder != NULL)
+                continue;
+            for (; n_decoded <= parts_info[j].image; n_decoded++)
+                if (!decode_next_pixels(stream, image->p[n_decoded]))
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+            pixel *beg_pixel = parts_pixel[j] - parts_info[j].ghost_cells_left;
+            MPI_Isend(beg_pixel, parts_info[j].width, COLUMNS[parts_info[j].image], parts_info[j].owner, parts_info[j].order, comm, &send_reqs[n_sends++]);
+        }
+        for (; n_decoded < n_images; n_decoded++)
+            if (!decode_next_pixels(stream, image->p[n_decoded]))
+                MPI_Abort(MPI_COMM_WORLD, 1);
+
+        // Copy it's own data directly from the image (by columns, as the workers get it)
+        for (j = 0; j < n_total_parts; j++){
+            if (parts_info[j].owner != 0)
+                continue;
+            int n_pixels_recv = parts_info[j].width * parts_info[j].height;
+            root_pixel[j] = (pixel *)malloc( n_pixels_recv * sizeof(pixel) );
+            if (decoder != NULL)
+                decode_part(decoder, &index[parts_info[j].image], parts_info[j], root_pixel[j]);
+            else
+                copy_rows_to_columns(parts_pixel[j] - parts_info[j].ghost_cells_left, image->width[parts_info[j].image], parts_info[j].width, parts_info[j].height, root_pixel[j]);
+        }
+
+        // Ghost cells are read from the image: results can only come back once everything is sent
+        MPI_Waitall(n_sends, send_reqs, MPI_STATUSES_IGNORE);
+        for (j = 0; j < n_total_parts; j++){
+            if (parts_info[j].owner == 0 || (encoded != NULL && image_owner(parts_info, j) != 0))
+                continue;
+            recv_part[n_recvs] = j;
+            MPI_Irecv(parts_pixel[j], parts_info[j].n_columns, COLUMNS[parts_info[j].image], parts_info[j].owner, parts_info[j].order, comm, &recv_reqs[n_recvs++]);
+        }
+
+        // Root work if needed (parts are in round order)
+        for (j = 0; j < n_total_parts; j++){
+            if (parts_info[j].owner != 0)
+                continue;
+
+            //Working part
+            call_worker(local_comm, parts_info[j], root_pixel[j], rank);
+
+            // Put the job back in the image, or send it to the process encoding this image
+            pixel *pixel_middle = root_pixel[j] + parts_info[j].ghost_cells_left * parts_info[j].height;
+            if (encoded != NULL && image_owner(parts_info, j) != 0){
+                MPI_Isend(pixel_middle, parts_info[j].n_columns * parts_info[j].height * 3, MPI_INT, image_owner(parts_info, j), parts_info[j].order, comm, &fwd_reqs[n_fwds++]);
+                continue;
             }
-            tab_leng[1] = n_int_img_info;
-            for (i=2; i < n_process + root_not_work; i++){
-                displs[i] = displs[i-1] + n_int_img_info;
-                tab_leng[i] = n_int_img_info;
+            copy_columns_to_rows(pixel_middle, parts_info[j].n_columns, parts_info[j].height, parts_pixel[j], image->width[parts_info[j].image]);
+            free(root_pixel[j]);
+            root_pixel[j] = NULL;
+            if (writer != NULL && --parts_left[parts_info[j].image] == 0 && !write_gif_frame(writer, parts_info[j].image))
+                MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        // Receive the parts (in any order when writing, a frame is written once all of its parts are here)
+        if (writer == NULL)
+            MPI_Waitall(n_recvs, recv_reqs, MPI_STATUSES_IGNORE);
+        else
+            for (i = 0; i < n_recvs; i++){
+                int k;
+                MPI_Waitany(n_recvs, recv_reqs, &k, MPI_STATUS_IGNORE);
+                if (--parts_left[parts_info[recv_part[k]].image] == 0 && !write_gif_frame(writer, parts_info[recv_part[k]].image))
+                    MPI_Abort(MPI_COMM_WORLD, 1);
             }
+        MPI_Waitall(n_fwds, fwd_reqs, MPI_STATUSES_IGNORE);
+        for (j = 0; j < n_total_parts; j++)
+            free(root_pixel[j]);
+        free(send_reqs);
+        free(recv_reqs);
+        free(recv_part);
+        free(fwd_reqs);
+        free(root_pixel);
+
+        // Compress the frames (only the ones whose first part was done here are in image)
+        if (encoded != NULL){
+            pixel *frames[n_images];
+            for (i = 0; i < n_images; i++)
+                frames[i] = NULL;
+            for (j = 0; j < n_total_parts; j++)
+                if (parts_info[j].order_sub_img == 0 && parts_info[j].owner == 0)
+                    frames[parts_info[j].image] = image->p[parts_info[j].image];
+            encode_frames(comm, RED_COMM_WORLD, parts_info, n_total_parts, frames, image, encoded);
         }
 
-        int parts_done = 0;
+        *n_process_used = n_process;
+        *root_work_used = root_work;
+        *has_used_gpu = ((double)(parts_info[0].width) * parts_info[0].height > 1000000) ? 1 : 0;
 
-        for(r=0; r < n_rounds; r++){
-            
-            int n_part_to_send =  n_process;
-            int root_part =  parts_done;
-            img_info *begin_table = parts_info + root_part;
-
-            // Send the part_info to the process
-            MPI_Scatterv(begin_table,tab_leng,displs,MPI_INT,&lol,n_int_img_info, MPI_INT,0,RED_COMM_WORLD);
-
-            // Sending the images
-            int beginning = root_work;
-            int ending = n_part_to_send;
-            for (j=beginning; j < ending ; j++){
-                pixel *beg_pixel = parts_pixel[root_part + j] - parts_info[root_part + j].ghost_cells_left;
-                MPI_Send(beg_pixel, parts_info[root_part + j].width, COLUMNS[parts_info[root_part + j].image], j + (1 - root_work), 0, MPI_COMM_WORLD);
-                parts_done++;
+        for (i = 0; i < n_images; i++)
+            MPI_Type_free(&COLUMNS[i]);
+        free(COLUMNS);
+        free(parts_pixel);
+    }
+    /* -------------------- ALGORITHM FOR SLAVE PROCESS -------------------- */
+    else if (rank < n_process) {
+
+        // Find my parts in the schedule
+        int n_my_parts = 0;
+        for (j = 0; j < n_total_parts; j++)
+            if (parts_info[j].owner == rank)
+                n_my_parts++;
+
+        // At least one entry: a process may get no part, it still goes through the rest (no zero-size allocation)
+        int n_alloc = (n_my_parts > 0) ? n_my_parts : 1;
+        int *my_parts = (int *)malloc(n_alloc * sizeof(int));
+        pixel **pixel_recv = (pixel **)malloc(n_alloc * sizeof(pixel *));
+        MPI_Request *recv_reqs = (MPI_Request *)malloc(n_alloc * sizeof(MPI_Request));
+        MPI_Request *send_reqs = (MPI_Request *)malloc(n_alloc * sizeof(MPI_Request));
+
+        // Alloc and post the receives of all my parts (unless they are decoded here)
+        n_my_parts = 0;
+        for (j = 0; j < n_total_parts; j++){
+            if (parts_info[j].owner != rank)
+                continue;
+            int n_pixels_recv = parts_info[j].height * parts_info[j].width;
+            my_parts[n_my_parts] = j;
+            pixel_recv[n_my_parts] = (pixel *)malloc( n_pixels_recv * sizeof(pixel) );
+            if (decoder == NULL)
+                MPI_Irecv(pixel_recv[n_my_parts], n_pixels_recv * 3, MPI_INT, 0, parts_info[j].order, comm, &recv_reqs[n_my_parts]);
+            n_my_parts++;
+        }
+
+        for (i = 0; i < n_my_parts; i++){
+            img_info info_recv = parts_info[my_parts[i]];
+
+            // Wait for the data, or decode it
+            if (decoder == NULL)
+                MPI_Wait(&recv_reqs[i], MPI_STATUS_IGNORE);
+            else
+                decode_part(decoder, &index[info_recv.image], info_recv, pixel_recv[i]);
+
+            // Work
+            call_worker(local_comm, info_recv, pixel_recv[i], rank);
+
+            // Send back (to the root, or to the process encoding this image: nothing to send if it is me)
+            pixel *pixel_middle = pixel_recv[i] + info_recv.ghost_cells_left * info_recv.height;
+            int n_pixels_to_send = info_recv.n_columns * info_recv.height;
+            int dest = (encoded != NULL) ? image_owner(parts_info, my_parts[i]) : 0;
+            send_reqs[i] = MPI_REQUEST_NULL;
+            if (dest != rank)
+                MPI_Isend(pixel_middle, n_pixels_to_send * 3, MPI_INT, dest, info_recv.order, comm, &send_reqs[i]);
+        }
+
+        // Assemble the images I encode, by rows, then compress them
+        if (encoded != NULL){
+            int n_images_total = parts_info[n_total_parts - 1].image + 1;
+            pixel *frames[n_images_total];
+            for (i = 0; i < n_images_total; i++)
+                frames[i] = NULL;
+
+            for (i = 0; i < n_my_parts; i++){
+                int first = my_parts[i];
+                if (parts_info[first].order_sub_img != 0)
+                    continue;
+                int width = image_width(parts_info, n_total_parts, first);
+                int height = parts_info[first].height;
+                pixel *frame = (pixel *)malloc(width * height * sizeof(pixel));
+                MPI_Datatype COLUMN = create_column(width, height);
+
+                for (j = first; j < n_total_parts && parts_info[j].image == parts_info[first].image; j++){
+                    if (parts_info[j].owner != rank){
+                        MPI_Recv(frame + parts_info[j].first_column, parts_info[j].n_columns, COLUMN, parts_info[j].owner, parts_info[j].order, comm, MPI_STATUS_IGNORE);
+                        continue;
+                    }
+                    int p_idx = 0;
+                    while (my_parts[p_idx] != j)
+                        p_idx++;
+                    pixel *pixel_middle = pixel_recv[p_idx] + parts_info[j].ghost_cells_left * height;
+                    copy_columns_to_rows(pixel_middle, parts_info[j].n_columns, height, frame + parts_info[j].first_column, width);
+                }
+                MPI_Type_free(&COLUMN);
+                frames[parts_info[first].image] = frame;
             }
-            
-            // Root work if needed
-            if (root_work){
-                // Prepare receiving it's own data && Send to itself
-                int n_pixels_recv = parts_info[root_part].width * parts_info[root_part].height;
-                pixel *pixel_recv = (pixel *)malloc( n_pixels_recv * sizeof(pixel) );
-                MPI_Isend(parts_pixel[root_part], parts_info[root_part].width, COLUMNS[parts_info[root_part].image], 0, 0, MPI_COMM_SELF, &req);
-                MPI_Recv(pixel_recv, n_pixels_recv * 3, MPI_INT, 0, MPI_ANY_TAG, MPI_COMM_SELF, &status);
-
-                //Working part
-                call_worker(local_comm, parts_info[root_part], pixel_recv, rank);
-
-                // Receive the job again
-                int n_pixels_to_send = parts_info[root_part].n_columns * parts_info[root_part].height;
-                MPI_Isend(pixel_recv, n_pixels_to_send * 3, MPI_INT, 0, status.MPI_TAG, MPI_COMM_SELF, &req);
-                MPI_Recv(parts_pixel[root_part], parts_info[root_part].n_columns, COLUMNS[parts_info[root_part].image], 0, MPI_ANY_TAG, MPI_COMM_SELF, &status);
-
-                parts_done++;
+
+            encode_frames(comm, RED_COMM_WORLD, parts_info, n_total_parts, frames, NULL, NULL);
+            for (i = 0; i < n_images_total; i++)
+                free(frames[i]);
+        }
+
+        MPI_Waitall(n_my_parts, send_reqs, MPI_STATUSES_IGNORE);
+        for (i = 0; i < n_my_parts; i++)
+            free(pixel_recv[i]);
+        free(pixel_recv);
+        free(my_parts);
+        free(recv_reqs);
+        free(send_reqs);
+    }
+
+    free(parts_info);
+    MPI_Comm_free(&local_comm);
+    MPI_Comm_free(&RED_COMM_WORLD);
+}
+
+void filter_frames_hierarchical(animated_gif *image, int n_images, int beta, int num_threads, GifFileType *decoder, GifFrameIndex *index, int *n_nodes_used, int *root_work_used, int *has_used_gpu){
+    // Rank 0 sends whole frames once to one leader per node, each leader runs filter_frames on its node and sends the frames back
+    // If decoder is not NULL, nothing is sent: the process of each node decode their parts from the file
+
+    int rank, node_rank, node_size;
+    int n_leaders, leader_rank;
+    MPI_Comm node_comm, leader_comm;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    /* -------------------- ONE COMMUNICATOR PER NODE, ONE FOR THE LEADERS -------------------- */
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_split(MPI_COMM_WORLD, (node_rank == 0) ? 0 : MPI_UNDEFINED, rank, &leader_comm);
+
+    int i, f;
+    int n_local = 0, first_local = 0;
+    int n_process_used = 0, gpu_used = 0;
+    animated_gif node_image;
+    int *first_frame = NULL, *all_width = NULL, *all_height = NULL;
+    MPI_Request *reqs = NULL;
+
+    /* -------------------- SEND THE SHARE OF EACH NODE TO ITS LEADER -------------------- */
+    if (node_rank == 0){
+        MPI_Comm_size(leader_comm, &n_leaders);
+        MPI_Comm_rank(leader_comm, &leader_rank);
+
+        // Nodes get a number of frames proportional to their number of process
+        int node_sizes[n_leaders];
+        MPI_Gather(&node_size, 1, MPI_INT, node_sizes, 1, MPI_INT, 0, leader_comm);
+
+        first_frame = (int *)malloc((n_leaders + 1) * sizeof(int));
+        if (leader_rank == 0){
+            int total_size = 0, cumul = 0;
+            for (i = 0; i < n_leaders; i++)
+                total_size += node_sizes[i];
+            for (i = 0; i < n_leaders; i++){
+                first_frame[i] = (int)((long)n_images * cumul / total_size);
+                cumul += node_sizes[i];
             }
+            first_frame[n_leaders] = n_images;
+        }
+        MPI_Bcast(first_frame, n_leaders + 1, MPI_INT, 0, leader_comm);
+        MPI_Bcast(&n_images, 1, MPI_INT, 0, leader_comm);
+
+        all_width = (int *)malloc(n_images * sizeof(int));
+        all_height = (int *)malloc(n_images * sizeof(int));
+        if (leader_rank == 0){
+            memcpy(all_width, image->width, n_images * sizeof(int));
+            memcpy(all_height, image->height, n_images * sizeof(int));
+        }
+        MPI_Bcast(all_width, n_images, MPI_INT, 0, leader_comm);
+        MPI_Bcast(all_height, n_images, MPI_INT, 0, leader_comm);
+
+        first_local = first_frame[leader_rank];
+        n_local = first_frame[leader_rank + 1] - first_local;
+        node_image.n_images = n_local;
+        node_image.width = all_width + first_local;
+        node_image.height = all_height + first_local;
+        node_image.mask = NULL;
+        node_image.g = NULL;
+
+        if (leader_rank == 0){
+            // The root keeps its share in place and sends the others
+            reqs = (MPI_Request *)malloc(n_images * sizeof(MPI_Request));
+            node_image.p = image->p + first_local;
+            if (image->mask != NULL)
+                node_image.mask = image->mask + first_local;
+            for (f = first_frame[1]; f < n_images && decoder == NULL; f++){
+                int owner = 1;
+                while (first_frame[owner + 1] <= f)
+                    owner++;
+                MPI_Isend(image->p[f], all_width[f] * all_height[f] * 3, MPI_INT, owner, f, leader_comm, &reqs[f]);
+            }
+        } else {
+            node_image.p = (pixel **)malloc(n_local * sizeof(pixel *));
+            for (i = 0; i < n_local; i++){
+                f = first_local + i;
+                node_image.p[i] = (pixel *)malloc(all_width[f] * all_height[f] * sizeof(pixel));
+                if (decoder == NULL)
+                    MPI_Recv(node_image.p[i], all_width[f] * all_height[f] * 3, MPI_INT, 0, f, leader_comm, MPI_STATUS_IGNORE);
+            }
+        }
+    }
 
-            // Receive the parts
-            for (j=beginning; j < ending; j++){
-                MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD,&status);
-                int pn = status.MPI_SOURCE - root_not_work;
-                MPI_Recv(parts_pixel[root_part + pn], parts_info[root_part + pn].n_columns, COLUMNS[parts_info[root_part + pn].image], status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, &status);
+    /* -------------------- FILTER THE FRAMES INSIDE EACH NODE -------------------- */
+    MPI_Bcast(&n_local, 1, MPI_INT, 0, node_comm);
+    MPI_Bcast(&first_local, 1, MPI_INT, 0, node_comm);
+    if (n_local > 0)
+        filter_frames(node_comm, &node_image, n_local, beta, num_threads, decoder, (decoder != NULL) ? index + first_local : NULL, NULL, NULL, NULL, &n_process_used, root_work_used, &gpu_used);
+
+    /* -------------------- GATHER THE FRAMES BACK ON THE ROOT -------------------- */
+    if (node_rank == 0){
+        if (leader_rank == 0){
+            // Frames were only read: they can be overwritten once sent
+            for (f = first_frame[1]; f < n_images && decoder == NULL; f++)
+                MPI_Wait(&reqs[f], MPI_STATUS_IGNORE);
+            for (f = first_frame[1]; f < n_images; f++){
+                int owner = 1;
+                while (first_frame[owner + 1] <= f)
+                    owner++;
+                MPI_Irecv(image->p[f], all_width[f] * all_height[f] * 3, MPI_INT, owner, f, leader_comm, &reqs[f]);
             }
-        } 
-            
-        
-        // Get final time
-        gettimeofday(&t12, NULL);
-        printf_time("\ntotal", t11, t12);
+            for (f = first_frame[1]; f < n_images; f++)
+                MPI_Wait(&reqs[f], MPI_STATUS_IGNORE);
+            free(reqs);
+        } else {
+            for (i = 0; i < n_local; i++){
+                f = first_local + i;
+                MPI_Send(node_image.p[i], all_width[f] * all_height[f] * 3, MPI_INT, 0, f, leader_comm);
+                free(node_image.p[i]);
+            }
+            free(node_image.p);
+        }
 
-        // Save result if needed
-        if(is_file_performance == 1){
+        MPI_Allreduce(&gpu_used, has_used_gpu, 1, MPI_INT, MPI_LOR, leader_comm);
+        *n_nodes_used = n_leaders;
+        free(first_frame);
+        free(all_width);
+        free(all_height);
+        MPI_Comm_free(&leader_comm);
+    }
+    MPI_Comm_free(&node_comm);
+}
 
-            int HAS_USED_GPU = ((double)(parts_info[0].width) * parts_info[0].height > 1000000) ? 1 : 0;
+int window_size(animated_gif *image, int first, long budget){ // Number of frames from first whose pixels fit in budget bytes (at least one)
+    int last = first;
+    long bytes = 0;
+    while (last < image->n_images){
+        long frame_bytes = (long)image->width[last] * image->height[last] * sizeof(pixel);
+        if (last > first && bytes + frame_bytes > budget)
+            break;
+        bytes += frame_bytes;
+        last++;
+    }
+    return last - first;
+}
 
-            int proc_node = 8/num_threads;
-            int nodes = n_process/proc_node;
-            if (n_process%proc_node!=0)
-                nodes++;
+void filter_frames_windowed(animated_gif *image, int n_images, long budget, int beta, int num_threads, GifFileType *stream, gif_writer *writer, int *n_process_used, int *root_work_used, int *has_used_gpu){
+    // Filter the frames of image (only known by rank 0) a window at a time: the frames of a window are decoded from stream,
+    // filtered and written by writer (which frees them) before the next window is decoded, so that the frames held by the
+    // root never take more than budget bytes (but for a single bigger frame), whatever the number of frames
+    int n_process, rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &n_process);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-            FILE *filetow = fopen(perf_filename, "a");
-            double duration = (t12.tv_sec-t11.tv_sec)+((t12.tv_usec-t11.tv_usec)/1e6);
-            char *name = input_filename;
-            fprintf(filetow, "time: %lf; process: %d; threads: %d; node: %d; image: %s; n_images: %d; w: %d; h: %d; beta: %d; root_work: %d; gpu: %d; \n", duration, n_process, num_threads, nodes, name, n_images, width, height,beta, root_work, HAS_USED_GPU) ;
-            fclose(filetow);
+    // Same choice as filter_frames, but for all the frames: the windows do not print theirs
+    if (rank == 0 && n_process > 1){
+        int threads = num_threads, reduced_process = 0, root_work = 1, n_rounds, n_parts;
+        int n_parts_per_img[n_images];
+        set_optimal_parameters(&n_process, &threads, &reduced_process, &root_work);
+        if (n_process > 1){
+            if (!root_work)
+                n_process--;
+            get_heuristics(&n_rounds, &n_parts, n_parts_per_img, n_process, n_images, beta);
+            print_heuristics(n_images, n_process, n_rounds, n_parts_per_img);
+        }
+    }
+    show_heuristics = 0;
+
+    int first = 0, n_window;
+    while (1){
+        animated_gif window;
+        if (rank == 0){
+            n_window = (first < n_images) ? window_size(image, first, budget) : 0;
+            if (n_window > 0 && !alloc_pixels(image, first, n_window))
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            window = *image;
+            window.n_images = n_window;
+            window.width = image->width + first;
+            window.height = image->height + first;
+            window.p = image->p + first;
+            writer->first = first;
         }
+        MPI_Bcast(&n_window, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (n_window == 0)
+            break;
 
-        // Export the gif
-        if ( !store_pixels( output_filename, image ) ){
-            return 1 ;
+        filter_frames(MPI_COMM_WORLD, (rank == 0) ? &window : NULL, n_window, beta, num_threads, NULL, NULL, (rank == 0) ? stream : NULL, NULL, (rank == 0) ? writer : NULL, n_process_used, root_work_used, has_used_gpu);
+        first += n_window;
+    }
+    show_heuristics = 1;
+}
+
+/******************************************************************* MAIN **********************************************************************************/
+
+int main( int argc, char ** argv ){
+
+    /* -------------------- MPI_INIT AND THREAD INIT -------------------- */ 
+    int n_process, rank;
+    int thread_priority_given, thread_priority_asked = 2;
+
+    MPI_Init_thread(&argc, &argv, thread_priority_asked, &thread_priority_given);
+    MPI_Comm_size(MPI_COMM_WORLD, &n_process);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    int num_threads = 1;
+
+    #ifdef _OPENMP
+        #pragma omp parallel
+        {
+            num_threads = omp_get_num_threads();
         }
+    #endif
+
+    /* -------------------- VARIABLES FOR OPTIONS -------------------- */
 
-        // Stop all process
-        for(i=0; i < n_process; i++)
-            parts_info[i].height = 0;
-        MPI_Scatterv(parts_info, tab_leng,displs, MPI_INT,&lol,n_int_img_info, MPI_INT,0,RED_COMM_WORLD);
+    int is_file_performance = 0; // to save the result in a file
+    char * perf_filename ;
+    int beta  = 1; // choose if you want to limitate the number of parts of image (1) or not (0)
+    int root_work = 1; // to set if you want that the root process work (1) or not (0)
+    int hierarchical = 0; // 1 to send whole frames to one leader per node, which splits them inside its node
+    int distributed_decode = 0; // 1 if every process decodes its own frames from the file (root only scans it)
+    int distributed_encode = 0; // 1 if the frames are compressed where they are filtered (root only writes them)
+    int literal = 0; // 1 to store the pixels without LZW compression (faster, bigger output)
+    int stream_decode = 0; // 1 if the root decodes the frames one by one while the first ones are filtered
+    int stream_write = 0; // 1 if the root writes each frame as soon as it is filtered (and the ones before)
+    int deduplicate = 1; // 1 to filter only once the frames repeated in the animation
+    int composite = 0; // 1 to filter the frames as displayed, drawn over what the previous ones left
+    int interframe = 0; // 1 to write of each frame only what changed since the previous one
+    int transparency = 0; // 1 to keep the transparent pixels transparent, and not to filter where there are only such pixels
+    int memory = 0; // if not 0, MB of decoded frames the root holds at once (frames are decoded, filtered and written window by window)
+
+    if(argc < 3 || (argc-3)%2 != 0){
+        print_how_to(rank);
+        return 1;
     }
-    /* -------------------- ALGORITHM FOR SLAVE PROCESS -------------------- */
-    else if (rank < n_process) {
-        MPI_Status status;
 
-        img_info info_recv;
-        pixel *pixel_recv, *pixel_middle;
+    char *input_filename = argv[1];
+    char *output_filename = argv[2];
 
-        while(1){
+    int i;
+    for (i = 3; i < argc-1; i++){
+        if (strcmp(argv[i], "-file") == 0){
+            is_file_performance = 1;
+            perf_filename = argv[i+1];
+        }
+        if (strcmp(argv[i], "-hierarchical") == 0)
+            hierarchical = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-distdecode") == 0)
+            distributed_decode = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-distencode") == 0)
+            distributed_encode = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-literal") == 0)
+            literal = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-streamdecode") == 0)
+            stream_decode = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-streamwrite") == 0)
+            stream_write = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-dedup") == 0)
+            deduplicate = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-tilecache") == 0)
+            tile_cache = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-composite") == 0)
+            composite = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-interframe") == 0)
+            interframe = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-transparent") == 0)
+            transparency = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-memory") == 0)
+            memory = atoi(argv[i+1]);
+    }
+    if (memory){
+        // Only the frames of the current window exist: nothing that needs all of them at once
+        stream_decode = stream_write = 1;
+        hierarchical = distributed_decode = distributed_encode = 0;
+        composite = interframe = transparency = 0;
+    }
+    if (distributed_decode || stream_decode)
+        composite = transparency = 0;
+    if (composite){
+        interframe = 1;
+        transparency = 0;
+    }
+    if (interframe || transparency)
+        stream_write = distributed_encode = 0;
+    if (hierarchical || distributed_decode)
+        stream_decode = 0;
+    if (hierarchical || distributed_encode)
+        stream_write = 0;
+    if (distributed_decode || stream_decode || distributed_encode)
+        deduplicate = 0;
+
+    /* -------------------- LOAD THE IMAGE -------------------- */ 
+    int n_images = 0;
+    int height = 0;
+    int width = 0;
+    int n_nodes = 1;
+    int HAS_USED_GPU = 0;
+    animated_gif * image = NULL;
+    GifFileType * decoder = NULL;
+    GifFileType * stream = NULL;
+    GifFrameIndex * index = NULL;
+    gif_writer * writer = NULL;
+    animated_gif unique_image; // frames actually filtered, without the duplicates
+    animated_gif * filtered = NULL;
+    int n_filtered = 0;
+    int * dup = NULL;
+    int * unique = NULL;
+    encoded_frames encoded = { NULL, NULL, NULL, literal };
+    struct timeval t11, t12;
 
-            // Check what is sent
-            MPI_Scatterv(NULL,NULL,NULL,MPI_INT,&info_recv, n_int_img_info, MPI_INT,0,RED_COMM_WORLD);
-            
-            int n_pixels_recv = info_recv.height * info_recv.width;
+    if(rank == 0){
+        if (distributed_decode || stream_decode){
+            image = (memory) ? scan_pixels_unmapped(input_filename, &index) : scan_pixels(input_filename, &index);
+            if (image == NULL)
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            n_images = image->n_images;
+            // With a memory budget, the pixels of each window are only allocated when it is decoded
+            if (!memory && !alloc_pixels(image, 0, n_images))
+                MPI_Abort(MPI_COMM_WORLD, 1);
+        } else if (composite){
+            // Every frame is the whole screen: the unchanged part is left to the tile cache, and is not written
+            image = load_composited_pixels(input_filename);
+            if (image == NULL)
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            n_images = image->n_images;
+        } else if (transparency){
+            image = load_transparent_pixels(input_filename);
+            if (image == NULL)
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            n_images = image->n_images;
+        } else
+            load_image_from_file(&image, &n_images, input_filename);
+
+        // The frames are decoded by filter_frames, reading the file once more in order
+        // (through stdio with a memory budget, like the scan: the pages of a mapping would stay in the memory of the root)
+        if (stream_decode){
+            int error;
+            stream = (memory) ? DGifOpenFileName(input_filename, &error) : DGifOpenFileMapped(input_filename, &error);
+            if (stream == NULL){
+                fprintf(stderr, "Error opening %s\n", input_filename);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
+        height = image->height[0];
+        width = image->width[0];
+        gettimeofday(&t11, NULL);
+        filtered = image;
+        n_filtered = n_images;
+
+        // Repeated frames share the pixels of their first copy, which is the only one filtered
+        if (deduplicate){
+            int n_unique, k = 0;
+            dup = find_duplicate_frames(image, &n_unique);
+            if (dup == NULL)
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            if (n_unique < n_images){
+                unique = (int *)malloc(n_unique * sizeof(int));
+                unique_image.n_images = n_unique;
+                unique_image.width = (int *)malloc(n_unique * sizeof(int));
+                unique_image.height = (int *)malloc(n_unique * sizeof(int));
+                unique_image.p = (pixel **)malloc(n_unique * sizeof(pixel *));
+                unique_image.mask = (image->mask != NULL) ? (unsigned char **)malloc(n_unique * sizeof(unsigned char *)) : NULL;
+                unique_image.g = image->g;
+                for (i = 0; i < n_images; i++){
+                    if (dup[i] != i){
+                        free(image->p[i]);
+                        image->p[i] = image->p[dup[i]];
+                        continue;
+                    }
+                    unique[k] = i;
+                    unique_image.width[k] = image->width[i];
+                    unique_image.height[k] = image->height[i];
+                    unique_image.p[k] = image->p[i];
+                    if (image->mask != NULL)
+                        unique_image.mask[k] = image->mask[i];
+                    k++;
+                }
+                filtered = &unique_image;
+                n_filtered = n_unique;
+#if SOBELF_DEBUG
+                printf(" ----> %d frame(s) out of %d are repeated, filtered once\n", n_images - n_unique, n_images);
+#endif
+            } else {
+                free(dup);
+                dup = NULL;
+            }
+        }
 
-            if (n_pixels_recv == 0)
-                break;
+        // The header of the output is written before filtering, the frames while filtering
+        if (stream_write){
+            writer = open_gif_writer(output_filename, image, literal, dup, unique);
+            if (writer == NULL)
+                MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
 
-            // Alloc and receive data
-            pixel_recv = (pixel *)malloc( n_pixels_recv * sizeof(pixel) );
-            MPI_Recv(pixel_recv, n_pixels_recv * 3, MPI_INT,0, 0, MPI_COMM_WORLD, &status);
+    /* -------------------- SHARE THE INDEX OF THE FRAMES -------------------- */ 
+    if (distributed_decode){
+        int error;
+        MPI_Bcast(&n_images, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (rank != 0)
+            index = (GifFrameIndex *)malloc(n_images * sizeof(GifFrameIndex));
+        MPI_Bcast(index, n_images * sizeof(GifFrameIndex), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+        // Every process reads the file on its own
+        decoder = DGifOpenFileMapped(input_filename, &error);
+        if (decoder == NULL){
+            fprintf(stderr, "Error DGifOpenFileMapped %s\n", input_filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
 
-            // Work
-            call_worker(local_comm, info_recv, pixel_recv, rank);
+    /* -------------------- FILTER -------------------- */ 
+    if (distributed_encode && rank == 0){
+        encoded.data = (GifByteType **)calloc(n_images, sizeof(GifByteType *));
+        encoded.length = (size_t *)calloc(n_images, sizeof(size_t));
+    }
 
-            // Send back
-            pixel_middle = pixel_recv + info_recv.ghost_cells_left * info_recv.height;
-            int n_pixels_to_send = info_recv.n_columns * info_recv.height;
-            MPI_Send(pixel_middle, n_pixels_to_send * 3, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD);
+    if (hierarchical)
+        filter_frames_hierarchical(filtered, n_filtered, beta, num_threads, decoder, index, &n_nodes, &root_work, &HAS_USED_GPU);
+    else if (memory)
+        filter_frames_windowed(filtered, n_filtered, memory * 1000000L, beta, num_threads, stream, writer, &n_process, &root_work, &HAS_USED_GPU);
+    else
+        filter_frames(MPI_COMM_WORLD, filtered, n_filtered, beta, num_threads, decoder, index, stream, (distributed_encode) ? &encoded : NULL, writer, &n_process, &root_work, &HAS_USED_GPU);
 
-            free(pixel_recv);
+    if (decoder != NULL)
+        DGifCloseFile(decoder, NULL);
+    if (stream != NULL)
+        DGifCloseFile(stream, NULL);
+    free(index); // shared by decoder and stream, NULL without them
+
+    /* -------------------- EXPORT ON THE ROOT -------------------- */ 
+    if(rank == 0){
+        
+        // Get final time
+        gettimeofday(&t12, NULL);
+        printf_time("\ntotal", t11, t12);
+
+        // Save result if needed
+        if(is_file_performance == 1){
+            if (!hierarchical){
+                int proc_node = 8/num_threads;
+                n_nodes = n_process/proc_node;
+                if (n_process%proc_node!=0)
+                    n_nodes++;
+            }
+            save_performance(perf_filename, t11, t12, n_process, num_threads, n_nodes, input_filename, n_images, width, height, beta, root_work, HAS_USED_GPU);
+        }
+
+        // Export the gif (already compressed if encoded.cmo is set, already written but the end with a writer)
+        if (writer != NULL){
+            if ( !close_gif_writer( writer ) )
+                return 1 ;
+        } else if (encoded.cmo != NULL){
+            if ( !store_encoded( output_filename, image, encoded.cmo, encoded.data, encoded.length ) )
+                return 1 ;
+            for (i = 0; i < n_images; i++)
+                free(encoded.data[i]);
+        } else if ( !store_pixels( output_filename, image, literal, interframe ) ){
+            return 1 ;
+        }
+        free(encoded.data);
+        free(encoded.length);
+        if (filtered == &unique_image){
+            free(unique_image.width);
+            free(unique_image.height);
+            free(unique_image.p);
+            free(unique_image.mask);
         }
+        free(dup);
+        free(unique);
     }
 
     MPI_Finalize();
@@ -588,7 +588,7 @@ int main( int argc, char ** argv ){
         }
 
         // Export the gif
-        if ( !store_pixels( output_filename, image ) ){
+        if ( !store_pixels( output_filename, image, 0, 0 ) ){
             return 1 ;
         }
 
@@ -0,0 +1,145 @@
+/*
+ * INF560
+ *
+ * Image Filtering Project
+ *
+ * Single process version: OpenMP only, no MPI nor CUDA needed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <string.h>
+#include <sys/time.h>
+#include <omp.h>
+
+#include "gif_lib.h"
+#include "utils.h"
+
+#define SIZE_STENCIL 5
+
+
+/******************************************************************* MAIN **********************************************************************************/
+
+int main( int argc, char ** argv ){
+
+    /* -------------------- THREAD INIT -------------------- */
+    int num_threads = 1;
+
+    #ifdef _OPENMP
+        #pragma omp parallel
+        {
+            num_threads = omp_get_num_threads();
+        }
+    #endif
+
+    /* -------------------- VARIABLES FOR OPTIONS -------------------- */
+
+    int is_file_performance = 0; // to save the result in a file
+    char * perf_filename ;
+    int literal = 0; // 1 to store the pixels without LZW compression (faster, bigger output)
+    int deduplicate = 1; // 1 to filter only once the frames repeated in the animation
+    int tile_cache = 1; // 1 to only filter again what changed since the previous frame
+    int composite = 0; // 1 to filter the frames as displayed, drawn over what the previous ones left
+    int interframe = 0; // 1 to write of each frame only what changed since the previous one
+    int transparency = 0; // 1 to keep the transparent pixels transparent, and not to filter where there are only such pixels
+
+    if(argc < 3 || (argc-3)%2 != 0){
+        print_how_to(0);
+        return 1;
+    }
+
+    char *input_filename = argv[1];
+    char *output_filename = argv[2];
+
+    int i;
+    for (i = 3; i < argc-1; i++){
+        if (strcmp(argv[i], "-file") == 0){
+            is_file_performance = 1;
+            perf_filename = argv[i+1];
+        }
+        if (strcmp(argv[i], "-literal") == 0)
+            literal = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-dedup") == 0)
+            deduplicate = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-tilecache") == 0)
+            tile_cache = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-composite") == 0)
+            composite = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-interframe") == 0)
+            interframe = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-transparent") == 0)
+            transparency = atoi(argv[i+1]);
+    }
+    if (composite){
+        interframe = 1;
+        transparency = 0;
+    }
+
+    /* -------------------- LOAD THE IMAGE -------------------- */
+    int n_images;
+    animated_gif * image ;
+    struct timeval t11, t12;
+
+    if (composite){
+        image = load_composited_pixels(input_filename);
+        if (image == NULL)
+            return 1;
+        n_images = image->n_images;
+    } else if (transparency){
+        image = load_transparent_pixels(input_filename);
+        if (image == NULL)
+            return 1;
+        n_images = image->n_images;
+    } else if ( load_image_from_file(&image, &n_images, input_filename) )
+        return 1;
+    gettimeofday(&t11, NULL);
+
+    /* -------------------- FILTER EVERY FRAME IN PLACE -------------------- */
+    // Repeated frames share the pixels of their first copy, which is the only one filtered
+    int *dup = NULL;
+    int n_unique;
+    if (deduplicate){
+        dup = find_duplicate_frames(image, &n_unique);
+        if (dup == NULL)
+            return 1;
+    }
+
+    filter_cache cache;
+    init_filter_cache(&cache);
+    for (i = 0; i < n_images; i++){
+        if (dup != NULL && dup[i] != i){
+            free(image->p[i]);
+            image->p[i] = image->p[dup[i]];
+            continue;
+        }
+        unsigned char *transparent = (image->mask != NULL) ? image->mask[i] : NULL;
+        if (tile_cache && n_images > 1)
+            apply_filters_one_frame_cached(image->width[i], image->height[i], image->p[i], SIZE_STENCIL, 20, &cache, transparent);
+        else if (transparent != NULL)
+            apply_filters_one_frame_transparent(image->width[i], image->height[i], image->p[i], SIZE_STENCIL, 20, transparent);
+        else
+            apply_filters_one_frame(image->width[i], image->height[i], image->p[i], SIZE_STENCIL, 20);
+    }
+    free_filter_cache(&cache);
+    free(dup);
+
+    // Get final time
+    gettimeofday(&t12, NULL);
+    printf_time("\ntotal", t11, t12);
+
+    // Save result if needed
+    if(is_file_performance == 1){
+        FILE *filetow = fopen(perf_filename, "a");
+        double duration = (t12.tv_sec-t11.tv_sec)+((t12.tv_usec-t11.tv_usec)/1e6);
+        fprintf(filetow, "time: %lf; process: %d; threads: %d; node: %d; image: %s; n_images: %d; w: %d; h: %d; beta: %d; root_work: %d; gpu: %d; \n", duration, 1, num_threads, 1, input_filename, n_images, image->width[0], image->height[0], 1, 1, 0) ;
+        fclose(filetow);
+    }
+
+    // Export the gif
+    if ( !store_pixels( output_filename, image, literal, interframe ) ){
+        return 1 ;
+    }
+
+    return 0;
+}
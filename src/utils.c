@@ -3,20 +3,137 @@
 #include <unistd.h>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/time.h>
-#include <mpi.h>
 #include <omp.h>
 
 #include "utils.h"
 
+static int decode_frame( GifFileType * g, GifFrameIndex * frame, pixel * p,
+        int transparent, unsigned char * mask ) ;
+static int colormap_pixels( ColorMapObject * colmap, pixel * lut ) ;
+static animated_gif *scan_file( char * filename, GifFrameIndex ** index, int mapped ) ;
+
 /*
  * Load a GIF image from a file and return a
  * structure of type animated_gif.
+ * The file is scanned first (scan_pixels), then the frames are
+ * decoded in parallel, each thread with its own decoder.
+ */
+static animated_gif *load_frames( char * filename, int keep_mask )
+{
+    GifFrameIndex * index ;
+    animated_gif * image ;
+    int * transparent ;
+    int i ;
+    int ok = 1 ;
+
+    image = scan_pixels( filename, &index ) ;
+    if ( image == NULL ) { return NULL ; }
+    if ( !alloc_pixels( image, 0, image->n_images ) ) { return NULL ; }
+
+    /* Frames with a transparent color get a mask of their transparent pixels */
+    transparent = (int *)malloc( image->n_images * sizeof( int ) ) ;
+    if ( transparent == NULL ) { return NULL ; }
+    if ( keep_mask )
+    {
+        image->mask = (unsigned char **)calloc( image->n_images, sizeof( unsigned char * ) ) ;
+        if ( image->mask == NULL ) { return NULL ; }
+    }
+    for ( i = 0 ; i < image->n_images ; i++ )
+    {
+        GraphicsControlBlock gcb ;
+
+        transparent[i] = NO_TRANSPARENT_COLOR ;
+        if ( keep_mask && DGifSavedExtensionToGCB( image->g, i, &gcb ) == GIF_OK )
+        {
+            transparent[i] = gcb.TransparentColor ;
+        }
+        if ( transparent[i] != NO_TRANSPARENT_COLOR )
+        {
+            image->mask[i] = (unsigned char *)malloc( image->width[i] * image->height[i] ) ;
+            if ( image->mask[i] == NULL )
+            {
+                fprintf( stderr, "Unable to allocate the mask of image %d\n", i ) ;
+                return NULL ;
+            }
+        }
+    }
+
+#pragma omp parallel reduction(&&:ok)
+    {
+        int error ;
+        GifFileType * g ;
+
+        g = DGifOpenFileMapped( filename, &error ) ;
+        if ( g == NULL )
+        {
+            fprintf( stderr, "Error DGifOpenFileMapped %s\n", filename ) ;
+            ok = 0 ;
+        }
+
+#pragma omp for schedule(dynamic)
+        for ( i = 0 ; i < image->n_images ; i++ )
+        {
+            if ( g == NULL || !decode_frame( g, &index[i], image->p[i], transparent[i],
+                        image->mask ? image->mask[i] : NULL ) )
+            {
+                ok = 0 ;
+            }
+        }
+
+        if ( g != NULL ) { DGifCloseFile( g, NULL ) ; }
+    }
+
+    free( index ) ;
+    free( transparent ) ;
+    if ( !ok ) { return NULL ; }
+
+#if SOBELF_DEBUG
+    printf( "-> GIF w/ %d image(s) with first image of size %d x %d\n",
+            image->n_images, image->width[0], image->height[0] ) ;
+#endif
+
+    return image ;
+}
+
+animated_gif *load_pixels( char * filename )
+{
+    return load_frames( filename, 0 ) ;
+}
+
+/*
+ * Same as load_pixels, with the transparent pixels of each frame
+ * in image->mask[i] (NULL when the frame has no transparent color).
+ */
+animated_gif *load_transparent_pixels( char * filename )
+{
+    return load_frames( filename, 1 ) ;
+}
+
+/*
+ * Scan a GIF file without decoding its frames: the returned
+ * animated_gif has its sizes, but no pixel arrays yet (see
+ * alloc_pixels), and index tells where to find each frame for
+ * decode_pixels.
+ */
+animated_gif *scan_pixels( char * filename, GifFrameIndex ** index )
+{
+    return scan_file( filename, index, 1 ) ;
+}
+
+/*
+ * Same as scan_pixels, reading the file through stdio: the pages of
+ * a mapping, all read by the scan, would stay in memory with image->g.
  */
-animated_gif *load_pixels( char * filename ) 
+animated_gif *scan_pixels_unmapped( char * filename, GifFrameIndex ** index )
+{
+    return scan_file( filename, index, 0 ) ;
+}
+
+static animated_gif *scan_file( char * filename, GifFrameIndex ** index, int mapped )
 {
     GifFileType * g ;
-    ColorMapObject * colmap ;
     int error ;
     int n_images ;
     int * width ;
@@ -26,222 +143,742 @@ animated_gif *load_pixels( char * filename )
     animated_gif * image ;
 
     /* Open the GIF image (read mode) */
-    g = DGifOpenFileName( filename, &error ) ;
+    g = mapped ? DGifOpenFileMapped( filename, &error ) : DGifOpenFileName( filename, &error ) ;
     if ( g == NULL ) 
     {
-        fprintf( stderr, "Error DGifOpenFileName %s\n", filename ) ;
+        fprintf( stderr, "Error opening %s\n", filename ) ;
         return NULL ;
     }
 
-    /* Read the GIF image */
-    error = DGifSlurp( g ) ;
+    /* Find the frames of the GIF image */
+    error = DGifScanFrames( g, index ) ;
     if ( error != GIF_OK )
     {
         fprintf( stderr, 
-                "Error DGifSlurp: %d <%s>\n", error, GifErrorString(g->Error) ) ;
+                "Error DGifScanFrames: %d <%s>\n", error, GifErrorString(g->Error) ) ;
         return NULL ;
     }
 
-    /* Grab the number of images and the size of each image */
     n_images = g->ImageCount ;
-
     width = (int *)malloc( n_images * sizeof( int ) ) ;
-    if ( width == NULL )
+    height = (int *)malloc( n_images * sizeof( int ) ) ;
+    p = (pixel **)calloc( n_images, sizeof( pixel * ) ) ;
+    image = (animated_gif *)malloc( sizeof(animated_gif) ) ;
+    if ( width == NULL || height == NULL || p == NULL || image == NULL )
     {
-        fprintf( stderr, "Unable to allocate width of size %d\n",
+        fprintf( stderr, "Unable to allocate the description of %d images\n",
                 n_images ) ;
+        return NULL ;
+    }
+
+    for ( i = 0 ; i < n_images ; i++ ) 
+    {
+        width[i] = (*index)[i].Width ;
+        height[i] = (*index)[i].Height ;
+
+        if ( !(*index)[i].HasColorMap && g->SColorMap == NULL )
+        {
+            fprintf( stderr, "Error: image %d has no colormap, nor has the file\n", i ) ;
+            return NULL ;
+        }
+    }
+
+    image->n_images = n_images ;
+    image->width = width ;
+    image->height = height ;
+    image->p = p ;
+    image->mask = NULL ;
+    image->g = g ;
+
+    return image ;
+}
+
+/*
+ * Allocate the (uninitialized) pixel arrays of the n frames of image
+ * from first on. Returns 0 on error.
+ */
+int alloc_pixels( animated_gif * image, int first, int n )
+{
+    int i ;
+
+    for ( i = first ; i < first + n ; i++ )
+    {
+        image->p[i] = (pixel *)malloc( image->width[i] * image->height[i] * sizeof( pixel ) ) ;
+        if ( image->p[i] == NULL )
+        {
+            fprintf( stderr, "Unable to allocate %d-th array of %d pixels\n",
+                    i, image->width[i] * image->height[i] ) ;
+            return 0 ;
+        }
+    }
+
+    return 1 ;
+}
+
+/*
+ * Decode one frame found by scan_pixels into p (width * height pixels).
+ * g can be any GifFileType opened on the same file.
+ */
+int decode_pixels( GifFileType * g, GifFrameIndex * frame, pixel * p )
+{
+    return decode_frame( g, frame, p, NO_TRANSPARENT_COLOR, NULL ) ;
+}
+
+/* Same as decode_pixels, mask (if not NULL) telling which pixels have the transparent color */
+static int decode_frame( GifFileType * g, GifFrameIndex * frame, pixel * p,
+        int transparent, unsigned char * mask )
+{
+    int j ;
+    int n_pixels = frame->Width * frame->Height ;
+    pixel lut[256] ;
+
+    GifPixelType * raster = (GifPixelType *)malloc( n_pixels * sizeof( GifPixelType ) ) ;
+    if ( raster == NULL )
+    {
+        fprintf( stderr, "Unable to allocate a frame of %d pixels\n", n_pixels ) ;
         return 0 ;
     }
 
-    height = (int *)malloc( n_images * sizeof( int ) ) ;
-    if ( height == NULL )
+    if ( DGifDecodeFrame( g, frame, raster ) != GIF_OK )
     {
-        fprintf( stderr, "Unable to allocate height of size %d\n",
-                n_images ) ;
+        fprintf( stderr, "Error DGifDecodeFrame: <%s>\n", GifErrorString(g->Error) ) ;
+        free( raster ) ;
         return 0 ;
     }
 
-    /* Fill the width and height */
-    for ( i = 0 ; i < n_images ; i++ ) 
+    /* The local colormap of the frame, read by DGifDecodeFrame, or the global one */
+    if ( !colormap_pixels( g->Image.ColorMap ? g->Image.ColorMap : g->SColorMap, lut ) )
     {
-        width[i] = g->SavedImages[i].ImageDesc.Width ;
-        height[i] = g->SavedImages[i].ImageDesc.Height ;
+        free( raster ) ;
+        return 0 ;
+    }
 
-#if SOBELF_DEBUG
-        printf( "Image %d: l:%d t:%d w:%d h:%d interlace:%d localCM:%p\n",
-                i, 
-                g->SavedImages[i].ImageDesc.Left,
-                g->SavedImages[i].ImageDesc.Top,
-                g->SavedImages[i].ImageDesc.Width,
-                g->SavedImages[i].ImageDesc.Height,
-                g->SavedImages[i].ImageDesc.Interlace,
-                g->SavedImages[i].ImageDesc.ColorMap
-                ) ;
-#endif
+    for ( j = 0 ; j < n_pixels ; j++ ) { p[j] = lut[ raster[j] ] ; }
+
+    if ( mask != NULL )
+    {
+        for ( j = 0 ; j < n_pixels ; j++ ) { mask[j] = ( raster[j] == transparent ) ; }
     }
 
+    free( raster ) ;
+    return 1 ;
+}
+
+/*
+ * Pixel of each of the 256 indexes of a frame, from the colormap it
+ * uses, so that decoding is a single lookup per pixel whichever the
+ * colormap. Indexes past the end of the colormap are black.
+ */
+static int colormap_pixels( ColorMapObject * colmap, pixel * lut )
+{
+    int c ;
 
-    /* Get the global colormap */
-    colmap = g->SColorMap ;
-    if ( colmap == NULL ) 
+    if ( colmap == NULL )
     {
-        fprintf( stderr, "Error global colormap is NULL\n" ) ;
-        return NULL ;
+        fprintf( stderr, "Error: frame without colormap\n" ) ;
+        return 0 ;
     }
 
-#if SOBELF_DEBUG
-    printf( "Global color map: count:%d bpp:%d sort:%d\n",
-            g->SColorMap->ColorCount,
-            g->SColorMap->BitsPerPixel,
-            g->SColorMap->SortFlag
-            ) ;
-#endif
+    for ( c = 0 ; c < 256 ; c++ )
+    {
+        if ( c < colmap->ColorCount )
+        {
+            lut[c].r = colmap->Colors[c].Red ;
+            lut[c].g = colmap->Colors[c].Green ;
+            lut[c].b = colmap->Colors[c].Blue ;
+        }
+        else
+        {
+            lut[c].r = lut[c].g = lut[c].b = 0 ;
+        }
+    }
+
+    return 1 ;
+}
+
+/*
+ * Load a GIF file as the successive states of its logical screen:
+ * each frame is drawn at ImageDesc.Left/Top over what the previous
+ * ones left (its transparent pixels leave it unchanged), then disposed
+ * of as its graphics control extension says. Every frame of the
+ * returned animated_gif covers the whole screen (SWidth x SHeight),
+ * and so do the descriptors; the frames are now opaque and left in
+ * place (see store_pixels to write only what each one changes).
+ */
+animated_gif *load_composited_pixels( char * filename )
+{
+    GifFrameIndex * index ;
+    animated_gif * image ;
+    GifByteType ** raster ;
+    pixel * canvas ;
+    pixel * saved = NULL ;
+    pixel background ;
+    int i ;
+    int ok = 1 ;
+
+    image = scan_pixels( filename, &index ) ;
+    if ( image == NULL ) { return NULL ; }
+
+    GifFileType * g = image->g ;
+    ColorMapObject * colmap = g->SColorMap ;
+    int n_pixels = g->SWidth * g->SHeight ;
 
-    /* Allocate the array of pixels to be returned */
-    p = (pixel **)malloc( n_images * sizeof( pixel * ) ) ;
-    if ( p == NULL )
+    raster = (GifByteType **)calloc( image->n_images, sizeof( GifByteType * ) ) ;
+    canvas = (pixel *)malloc( n_pixels * sizeof( pixel ) ) ;
+    if ( raster == NULL || canvas == NULL )
     {
-        fprintf( stderr, "Unable to allocate array of %d images\n",
-                n_images ) ;
+        fprintf( stderr, "Unable to allocate a screen of %d pixels\n", n_pixels ) ;
         return NULL ;
     }
 
-    for ( i = 0 ; i < n_images ; i++ ) 
+    /* Frames are decoded in parallel, as in load_pixels, then drawn in order */
+#pragma omp parallel reduction(&&:ok)
     {
-        p[i] = (pixel *)malloc( width[i] * height[i] * sizeof( pixel ) ) ;
-        if ( p[i] == NULL )
+        int error ;
+        GifFileType * g2 ;
+
+        g2 = DGifOpenFileMapped( filename, &error ) ;
+        if ( g2 == NULL )
         {
-        fprintf( stderr, "Unable to allocate %d-th array of %d pixels\n",
-                i, width[i] * height[i] ) ;
-        return NULL ;
+            fprintf( stderr, "Error DGifOpenFileMapped %s\n", filename ) ;
+            ok = 0 ;
         }
+
+#pragma omp for schedule(dynamic)
+        for ( i = 0 ; i < image->n_images ; i++ )
+        {
+            raster[i] = (GifByteType *)malloc( index[i].Width * index[i].Height * sizeof( GifByteType ) ) ;
+            if ( g2 == NULL || raster[i] == NULL || DGifDecodeFrame( g2, &index[i], raster[i] ) != GIF_OK )
+            {
+                fprintf( stderr, "Error decoding image %d\n", i ) ;
+                ok = 0 ;
+            }
+        }
+
+        if ( g2 != NULL ) { DGifCloseFile( g2, NULL ) ; }
     }
-    
-    /* Fill pixels */
 
-    /* For each image */
-    for ( i = 0 ; i < n_images ; i++ )
+    free( index ) ;
+    if ( !ok ) { return NULL ; }
+
+    /* The screen starts with the background color (black without a global colormap) */
+    background.r = background.g = background.b = 0 ;
+    if ( colmap != NULL )
     {
-        int j ;
+        i = ( g->SBackGroundColor < colmap->ColorCount ) ? g->SBackGroundColor : 0 ;
+        background.r = colmap->Colors[i].Red ;
+        background.g = colmap->Colors[i].Green ;
+        background.b = colmap->Colors[i].Blue ;
+    }
+    for ( i = 0 ; i < n_pixels ; i++ ) { canvas[i] = background ; }
 
-        /* Get the local colormap if needed */
-        if ( g->SavedImages[i].ImageDesc.ColorMap )
+    for ( i = 0 ; i < image->n_images ; i++ )
+    {
+        GifImageDesc * d = &g->SavedImages[i].ImageDesc ;
+        GraphicsControlBlock gcb ;
+        int has_gcb = ( DGifSavedExtensionToGCB( g, i, &gcb ) == GIF_OK ) ;
+        int left = d->Left, top = d->Top ;
+        int right = d->Left + d->Width, bottom = d->Top + d->Height ;
+        int x, y ;
+        pixel lut[256] ;
+
+        /* scan_pixels kept the local colormap of the frame, if any */
+        colormap_pixels( d->ColorMap ? d->ColorMap : colmap, lut ) ;
+
+        /* Only the part of the frame inside the screen is drawn */
+        if ( right > g->SWidth ) { right = g->SWidth ; }
+        if ( bottom > g->SHeight ) { bottom = g->SHeight ; }
+
+        if ( gcb.DisposalMode == DISPOSE_PREVIOUS )
         {
-
-            /* TODO No support for local color map */
-            fprintf( stderr, "Error: application does not support local colormap\n" ) ;
-            return NULL ;
-            colmap = g->SavedImages[i].ImageDesc.ColorMap ;
+            if ( saved == NULL ) { saved = (pixel *)malloc( n_pixels * sizeof( pixel ) ) ; }
+            if ( saved == NULL )
+            {
+                fprintf( stderr, "Unable to allocate a screen of %d pixels\n", n_pixels ) ;
+                return NULL ;
+            }
+            memcpy( saved, canvas, n_pixels * sizeof( pixel ) ) ;
         }
 
-        /* Traverse the image and fill pixels */
-        for ( j = 0 ; j < width[i] * height[i] ; j++ ) 
+        for ( y = top ; y < bottom ; y++ )
         {
-            int c ;
+            GifByteType * line = raster[i] + ( y - d->Top ) * d->Width ;
+            pixel * row = canvas + y * g->SWidth ;
+
+            for ( x = left ; x < right ; x++ )
+            {
+                int c = line[x - d->Left] ;
 
-            c = g->SavedImages[i].RasterBits[j] ;
+                if ( c == gcb.TransparentColor ) { continue ; }
+                row[x] = lut[c] ;
+            }
+        }
+        free( raster[i] ) ;
 
-            p[i][j].r = colmap->Colors[c].Red ;
-            p[i][j].g = colmap->Colors[c].Green ;
-            p[i][j].b = colmap->Colors[c].Blue ;
+        free( image->p[i] ) ;
+        image->p[i] = (pixel *)malloc( n_pixels * sizeof( pixel ) ) ;
+        if ( image->p[i] == NULL )
+        {
+            fprintf( stderr, "Unable to allocate %d-th array of %d pixels\n", i, n_pixels ) ;
+            return NULL ;
         }
-    }
+        memcpy( image->p[i], canvas, n_pixels * sizeof( pixel ) ) ;
+        image->width[i] = g->SWidth ;
+        image->height[i] = g->SHeight ;
 
-    /* Allocate image info */
-    image = (animated_gif *)malloc( sizeof(animated_gif) ) ;
-    if ( image == NULL ) 
-    {
-        fprintf( stderr, "Unable to allocate memory for animated_gif\n" ) ;
-        return NULL ;
-    }
+        if ( gcb.DisposalMode == DISPOSE_BACKGROUND )
+        {
+            for ( y = top ; y < bottom ; y++ )
+            {
+                for ( x = left ; x < right ; x++ ) { canvas[y * g->SWidth + x] = background ; }
+            }
+        }
+        else if ( gcb.DisposalMode == DISPOSE_PREVIOUS )
+        {
+            memcpy( canvas, saved, n_pixels * sizeof( pixel ) ) ;
+        }
 
-    /* Fill image fields */
-    image->n_images = n_images ;
-    image->width = width ;
-    image->height = height ;
-    image->p = p ;
-    image->g = g ;
+        /* The whole screen is drawn, without transparency nor disposal */
+        d->Left = 0 ;
+        d->Top = 0 ;
+        d->Width = g->SWidth ;
+        d->Height = g->SHeight ;
+        if ( has_gcb )
+        {
+            gcb.DisposalMode = DISPOSE_DO_NOT ;
+            gcb.TransparentColor = NO_TRANSPARENT_COLOR ;
+            EGifGCBToSavedExtension( &gcb, g, i ) ;
+        }
+    }
 
-#if SOBELF_DEBUG
-    printf( "-> GIF w/ %d image(s) with first image of size %d x %d\n",
-            image->n_images, image->width[0], image->height[0] ) ;
-#endif
+    free( raster ) ;
+    free( canvas ) ;
+    free( saved ) ;
 
     return image ;
 }
 
-int output_modified_read_gif( char * filename, GifFileType * g ) 
+/*
+ * Decode the next frame of g, opened on the same file as scan_pixels
+ * and only read through this function, into p (width * height pixels):
+ * frames come one after the other, in file order, through the low-level
+ * API, so nothing but the current frame is held. Extensions are skipped
+ * (scan_pixels already kept them).
+ */
+int decode_next_pixels( GifFileType * g, pixel * p )
 {
-    GifFileType * g2 ;
-    int error2 ;
+    GifRecordType record ;
+    GifByteType * ext ;
+    int ext_code ;
 
-#if SOBELF_DEBUG
-    printf( "Starting output to file %s\n", filename ) ;
-#endif
+    do
+    {
+        if ( DGifGetRecordType( g, &record ) == GIF_ERROR )
+        {
+            fprintf( stderr, "Error DGifGetRecordType: <%s>\n", GifErrorString(g->Error) ) ;
+            return 0 ;
+        }
 
-    g2 = EGifOpenFileName( filename, false, &error2 ) ;
-    if ( g2 == NULL )
+        if ( record == EXTENSION_RECORD_TYPE )
+        {
+            if ( DGifGetExtension( g, &ext_code, &ext ) == GIF_ERROR )
+            {
+                fprintf( stderr, "Error DGifGetExtension: <%s>\n", GifErrorString(g->Error) ) ;
+                return 0 ;
+            }
+            while ( ext != NULL )
+            {
+                if ( DGifGetExtensionNext( g, &ext ) == GIF_ERROR )
+                {
+                    fprintf( stderr, "Error DGifGetExtensionNext: <%s>\n", GifErrorString(g->Error) ) ;
+                    return 0 ;
+                }
+            }
+        }
+        else if ( record == TERMINATE_RECORD_TYPE )
+        {
+            fprintf( stderr, "Error: no frame left in the file\n" ) ;
+            return 0 ;
+        }
+    } while ( record != IMAGE_DESC_RECORD_TYPE ) ;
+
+    if ( DGifGetImageDesc( g ) == GIF_ERROR )
     {
-        fprintf( stderr, "Error EGifOpenFileName %s\n",
-                filename ) ;
+        fprintf( stderr, "Error DGifGetImageDesc: <%s>\n", GifErrorString(g->Error) ) ;
         return 0 ;
     }
 
-    g2->SWidth = g->SWidth ;
-    g2->SHeight = g->SHeight ;
-    g2->SColorResolution = g->SColorResolution ;
-    g2->SBackGroundColor = g->SBackGroundColor ;
-    g2->AspectByte = g->AspectByte ;
-    g2->SColorMap = g->SColorMap ;
-    g2->ImageCount = g->ImageCount ;
-    g2->SavedImages = g->SavedImages ;
-    g2->ExtensionBlockCount = g->ExtensionBlockCount ;
-    g2->ExtensionBlocks = g->ExtensionBlocks ;
+    int width = g->Image.Width ;
+    int height = g->Image.Height ;
+    pixel lut[256] ;
+    int j, k, pass ;
 
-    error2 = EGifSpew( g2 ) ;
-    if ( error2 != GIF_OK ) 
+    if ( !colormap_pixels( g->Image.ColorMap ? g->Image.ColorMap : g->SColorMap, lut ) ) { return 0 ; }
+
+    GifPixelType * line = (GifPixelType *)malloc( width * sizeof( GifPixelType ) ) ;
+    if ( line == NULL )
     {
-        fprintf( stderr, "Error after writing g2: %d <%s>\n", 
-                error2, GifErrorString(g2->Error) ) ;
+        fprintf( stderr, "Unable to allocate a line of %d pixels\n", width ) ;
         return 0 ;
     }
 
+    /* Rows are stored in the order of the 4 passes when interlaced */
+    int offset[] = { 0, 4, 2, 1 } ;
+    int jump[] = { 8, 8, 4, 2 } ;
+    int n_passes = g->Image.Interlace ? 4 : 1 ;
+    if ( !g->Image.Interlace ) { jump[0] = 1 ; }
+
+    for ( pass = 0 ; pass < n_passes ; pass++ )
+    {
+        for ( j = offset[pass] ; j < height ; j += jump[pass] )
+        {
+            if ( DGifGetLine( g, line, width ) == GIF_ERROR )
+            {
+                fprintf( stderr, "Error DGifGetLine: <%s>\n", GifErrorString(g->Error) ) ;
+                free( line ) ;
+                return 0 ;
+            }
+
+            pixel * row = p + j * width ;
+            for ( k = 0 ; k < width ; k++ ) { row[k] = lut[ line[k] ] ; }
+        }
+    }
+
+    free( line ) ;
     return 1 ;
 }
 
-int store_pixels( char * filename, animated_gif * image )
+/* 64 bits FNV-1a hash of n bytes, taken 8 by 8 */
+static uint64_t hash_bytes( const void * data, size_t n )
 {
-    int n_colors = 0 ;
-    pixel ** p ;
-    int i, j, k ;
-    GifColorType * colormap ;
+    const unsigned char * b = (const unsigned char *)data ;
+    uint64_t h = 14695981039346656037ULL ;
+    uint64_t word ;
+    size_t k ;
 
-    /* Initialize the new set of colors */
-    colormap = (GifColorType *)malloc( 256 * sizeof( GifColorType ) ) ;
-    if ( colormap == NULL ) 
+    for ( k = 0 ; k + 8 <= n ; k += 8 )
     {
-        fprintf( stderr,
-                "Unable to allocate 256 colors\n" ) ;
-        return 0 ;
+        memcpy( &word, b + k, 8 ) ;
+        h = ( h ^ word ) * 1099511628211ULL ;
     }
-
-    /* Everything is white by default */
-    for ( i = 0 ; i < 256 ; i++ ) 
+    for ( ; k < n ; k++ )
     {
-        colormap[i].Red = 255 ;
-        colormap[i].Green = 255 ;
-        colormap[i].Blue = 255 ;
+        h = ( h ^ b[k] ) * 1099511628211ULL ;
+    }
+
+    return h ;
+}
+
+/* Hash of a frame and its index, sorted to group the frames which may be the same */
+typedef struct frame_hash
+{
+    uint64_t hash ;
+    int index ;
+} frame_hash ;
+
+static int compare_frame_hashes( const void * a, const void * b )
+{
+    const frame_hash * x = (const frame_hash *)a ;
+    const frame_hash * y = (const frame_hash *)b ;
+
+    if ( x->hash != y->hash ) { return ( x->hash < y->hash ) ? -1 : 1 ; }
+    return x->index - y->index ;
+}
+
+/* Frames i and j, of the same size, have the same transparent pixels (see load_transparent_pixels) */
+static int same_mask( animated_gif * image, int i, int j )
+{
+    unsigned char * a = image->mask ? image->mask[i] : NULL ;
+    unsigned char * b = image->mask ? image->mask[j] : NULL ;
+
+    if ( a == NULL || b == NULL ) { return a == b ; }
+    return memcmp( a, b, (size_t)image->width[i] * image->height[i] ) == 0 ;
+}
+
+/*
+ * Find the frames with the same size and pixels (transparent ones too) as an earlier one
+ * (holds, loops...): dup[i] is the first frame identical to frame i,
+ * i itself if there is none. Frames are sorted by hash, then compared
+ * byte by byte only with the earlier frames of the same hash.
+ * Returns NULL on error, *n_unique is the number of i with dup[i] == i.
+ */
+int * find_duplicate_frames( animated_gif * image, int * n_unique )
+{
+    frame_hash * hash ;
+    int * dup ;
+    int i, j ;
+    int b, e, k, l ;
+
+    hash = (frame_hash *)malloc( image->n_images * sizeof( frame_hash ) ) ;
+    dup = (int *)malloc( image->n_images * sizeof( int ) ) ;
+    if ( hash == NULL || dup == NULL )
+    {
+        fprintf( stderr, "Unable to allocate the hashes of %d images\n", image->n_images ) ;
+        free( hash ) ;
+        free( dup ) ;
+        return NULL ;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for ( i = 0 ; i < image->n_images ; i++ )
+    {
+        hash[i].hash = hash_bytes( image->p[i], (size_t)image->width[i] * image->height[i] * sizeof( pixel ) ) ;
+        hash[i].index = i ;
+    }
+    qsort( hash, image->n_images, sizeof( frame_hash ), compare_frame_hashes ) ;
+
+    /* Frames [b,e) have the same hash, by increasing index */
+    *n_unique = 0 ;
+    for ( b = 0 ; b < image->n_images ; b = e )
+    {
+        for ( e = b + 1 ; e < image->n_images && hash[e].hash == hash[b].hash ; e++ ) { }
+
+        for ( k = b ; k < e ; k++ )
+        {
+            i = hash[k].index ;
+            dup[i] = i ;
+            for ( l = b ; l < k ; l++ )
+            {
+                j = hash[l].index ;
+                if ( dup[j] == j &&
+                        image->width[j] == image->width[i] && image->height[j] == image->height[i] &&
+                        memcmp( image->p[j], image->p[i], (size_t)image->width[i] * image->height[i] * sizeof( pixel ) ) == 0 &&
+                        same_mask( image, i, j ) )
+                {
+                    dup[i] = j ;
+                    break ;
+                }
+            }
+            if ( dup[i] == i ) { (*n_unique)++ ; }
+        }
+    }
+
+    free( hash ) ;
+    return dup ;
+}
+
+/*
+ * Images of g with the same descriptor, colormap and raster as an
+ * earlier one: same[i] is the first of them (i if there is none).
+ * Like find_duplicate_frames, only images of the same hash are compared.
+ */
+static int * find_same_rasters( GifFileType * g )
+{
+    frame_hash * hash ;
+    int * same ;
+    int i, j ;
+    int b, e, k, l ;
+
+    hash = (frame_hash *)malloc( g->ImageCount * sizeof( frame_hash ) ) ;
+    same = (int *)malloc( g->ImageCount * sizeof( int ) ) ;
+    if ( hash == NULL || same == NULL )
+    {
+        fprintf( stderr, "Unable to allocate the hashes of %d images\n", g->ImageCount ) ;
+        free( hash ) ;
+        free( same ) ;
+        return NULL ;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for ( i = 0 ; i < g->ImageCount ; i++ )
+    {
+        GifImageDesc * d = &g->SavedImages[i].ImageDesc ;
+
+        hash[i].hash = ( g->SavedImages[i].RasterBits == NULL ) ? 0 :
+            hash_bytes( g->SavedImages[i].RasterBits, (size_t)d->Width * d->Height ) ;
+        hash[i].index = i ;
+    }
+    qsort( hash, g->ImageCount, sizeof( frame_hash ), compare_frame_hashes ) ;
+
+    /* Images [b,e) have the same hash, by increasing index */
+    for ( b = 0 ; b < g->ImageCount ; b = e )
+    {
+        for ( e = b + 1 ; e < g->ImageCount && hash[e].hash == hash[b].hash ; e++ ) { }
+
+        for ( k = b ; k < e ; k++ )
+        {
+            i = hash[k].index ;
+            same[i] = i ;
+            if ( g->SavedImages[i].RasterBits == NULL ) { continue ; }
+
+            GifImageDesc * d = &g->SavedImages[i].ImageDesc ;
+
+            for ( l = b ; l < k ; l++ )
+            {
+                j = hash[l].index ;
+                GifImageDesc * f = &g->SavedImages[j].ImageDesc ;
+
+                if ( same[j] != j || g->SavedImages[j].RasterBits == NULL ||
+                        f->Width != d->Width || f->Height != d->Height || f->Interlace != d->Interlace ||
+                        ( f->ColorMap == NULL ) != ( d->ColorMap == NULL ) )
+                {
+                    continue ;
+                }
+                if ( d->ColorMap != NULL && ( f->ColorMap->ColorCount != d->ColorMap->ColorCount ||
+                            memcmp( f->ColorMap->Colors, d->ColorMap->Colors, d->ColorMap->ColorCount * sizeof( GifColorType ) ) != 0 ) )
+                {
+                    continue ;
+                }
+                if ( memcmp( g->SavedImages[j].RasterBits, g->SavedImages[i].RasterBits, (size_t)d->Width * d->Height ) == 0 )
+                {
+                    same[i] = j ;
+                    break ;
+                }
+            }
+        }
+    }
+
+    free( hash ) ;
+    return same ;
+}
+
+/*
+ * Write g to a file, its images being already compressed with
+ * EGifEncodeImage (encoded[i] has lengths[i] bytes for image i,
+ * NULL if it is not written).
+ */
+static int spew_encoded( char * filename, GifFileType * g,
+        GifByteType ** encoded, size_t * lengths )
+{
+    GifFileType * g2 ;
+    int error2 ;
+
+    g2 = EGifOpenFileName( filename, false, &error2 ) ;
+    if ( g2 == NULL )
+    {
+        fprintf( stderr, "Error EGifOpenFileName %s\n",
+                filename ) ;
+        return 0 ;
+    }
+
+    g2->SWidth = g->SWidth ;
+    g2->SHeight = g->SHeight ;
+    g2->SColorResolution = g->SColorResolution ;
+    g2->SBackGroundColor = g->SBackGroundColor ;
+    g2->AspectByte = g->AspectByte ;
+    g2->SColorMap = g->SColorMap ;
+    g2->ImageCount = g->ImageCount ;
+    g2->SavedImages = g->SavedImages ;
+    g2->ExtensionBlockCount = g->ExtensionBlockCount ;
+    g2->ExtensionBlocks = g->ExtensionBlocks ;
+
+    error2 = EGifSpewEncoded( g2, encoded, lengths ) ;
+    if ( error2 != GIF_OK ) 
+    {
+        fprintf( stderr, "Error after writing g2: %d <%s>\n", 
+                error2, GifErrorString(g2->Error) ) ;
+        return 0 ;
+    }
+
+    return 1 ;
+}
+
+/*
+ * Write g to a file, with every pixel stored as a literal code
+ * (no compression, see EGifSetLiteralCodes) if literal is set.
+ * Each image starts a new LZW code table: they are compressed in
+ * memory in parallel, each with its own encoder, then written in order.
+ * Identical images are compressed once.
+ */
+int output_modified_read_gif( char * filename, GifFileType * g, int literal ) 
+{
+    GifByteType ** encoded ;
+    size_t * lengths ;
+    int * same ;
+    int i ;
+    int ok = 1 ;
+
+#if SOBELF_DEBUG
+    printf( "Starting output to file %s\n", filename ) ;
+#endif
+
+    same = find_same_rasters( g ) ;
+    if ( same == NULL ) { return 0 ; }
+
+    encoded = (GifByteType **)calloc( g->ImageCount, sizeof( GifByteType * ) ) ;
+    lengths = (size_t *)calloc( g->ImageCount, sizeof( size_t ) ) ;
+    if ( encoded == NULL || lengths == NULL )
+    {
+        fprintf( stderr, "Unable to allocate the output of %d images\n",
+                g->ImageCount ) ;
+        return 0 ;
+    }
+
+#pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for ( i = 0 ; i < g->ImageCount ; i++ )
+    {
+        SavedImage * sp = &g->SavedImages[i] ;
+        int error ;
+
+        /* Not written, as in EGifSpew, or same data as an earlier image */
+        if ( sp->RasterBits == NULL || same[i] != i ) { continue ; }
+
+        if ( EGifEncodeImage( sp->ImageDesc.ColorMap ? sp->ImageDesc.ColorMap : g->SColorMap,
+                    sp->ImageDesc.Width, sp->ImageDesc.Height, sp->ImageDesc.Interlace,
+                    literal, sp->RasterBits, &encoded[i], &lengths[i], &error ) == GIF_ERROR )
+        {
+            fprintf( stderr, "Error EGifEncodeImage image %d: <%s>\n",
+                    i, GifErrorString(error) ) ;
+            ok = 0 ;
+        }
+    }
+
+    for ( i = 0 ; i < g->ImageCount ; i++ )
+    {
+        encoded[i] = encoded[ same[i] ] ;
+        lengths[i] = lengths[ same[i] ] ;
+    }
+
+    if ( ok )
+    {
+        ok = spew_encoded( filename, g, encoded, lengths ) ;
+    }
+
+    for ( i = 0 ; i < g->ImageCount ; i++ )
+    {
+        if ( same[i] == i ) { free( encoded[i] ) ; }
+    }
+    free( encoded ) ;
+    free( lengths ) ;
+    free( same ) ;
+
+    return ok ;
+}
+
+/*
+ * Start the colormap of the output: background color and
+ * transparency colors (extension blocks are updated).
+ * The local colormaps of the input are freed: the frames
+ * will only index the output one (or a part of it).
+ * Returns the number of colors used, 0 on error.
+ */
+int init_output_colormap( animated_gif * image, GifColorType * colormap )
+{
+    int n_colors = 0 ;
+    int i, j, k ;
+    ColorMapObject * colmap ;
+
+    /* Everything is white by default */
+    for ( i = 0 ; i < 256 ; i++ ) 
+    {
+        colormap[i].Red = 255 ;
+        colormap[i].Green = 255 ;
+        colormap[i].Blue = 255 ;
     }
 
     /* Change the background color and store it */
-    int moy ;
-    moy = (
-            image->g->SColorMap->Colors[ image->g->SBackGroundColor ].Red
-            +
-            image->g->SColorMap->Colors[ image->g->SBackGroundColor ].Green
-            +
-            image->g->SColorMap->Colors[ image->g->SBackGroundColor ].Blue
-            )/3 ;
+    int moy = 0 ;
+    if ( image->g->SColorMap != NULL &&
+            image->g->SBackGroundColor < image->g->SColorMap->ColorCount )
+    {
+        moy = (
+                image->g->SColorMap->Colors[ image->g->SBackGroundColor ].Red
+                +
+                image->g->SColorMap->Colors[ image->g->SBackGroundColor ].Green
+                +
+                image->g->SColorMap->Colors[ image->g->SBackGroundColor ].Blue
+                )/3 ;
+    }
     if ( moy < 0 ) moy = 0 ;
     if ( moy > 255 ) moy = 255 ;
 
@@ -262,6 +899,7 @@ int store_pixels( char * filename, animated_gif * image )
     n_colors++ ;
 
     /* Process extension blocks in main structure */
+    colmap = image->g->SColorMap ;
     for ( j = 0 ; j < image->g->ExtensionBlockCount ; j++ )
     {
         int f ;
@@ -271,7 +909,7 @@ int store_pixels( char * filename, animated_gif * image )
         {
             int tr_color = image->g->ExtensionBlocks[j].Bytes[3] ;
 
-            if ( tr_color >= 0 &&
+            if ( colmap != NULL && tr_color >= 0 &&
                     tr_color < 255 )
             {
 
@@ -279,11 +917,11 @@ int store_pixels( char * filename, animated_gif * image )
 
                 moy = 
                     (
-                     image->g->SColorMap->Colors[ tr_color ].Red
+                     colmap->Colors[ tr_color ].Red
                      +
-                     image->g->SColorMap->Colors[ tr_color ].Green
+                     colmap->Colors[ tr_color ].Green
                      +
-                     image->g->SColorMap->Colors[ tr_color ].Blue
+                     colmap->Colors[ tr_color ].Blue
                     ) / 3 ;
                 if ( moy < 0 ) moy = 0 ;
                 if ( moy > 255 ) moy = 255 ;
@@ -291,9 +929,9 @@ int store_pixels( char * filename, animated_gif * image )
 #if SOBELF_DEBUG
                 printf( "[DEBUG] Transparency color image %d (%d,%d,%d) -> (%d,%d,%d)\n",
                         i,
-                        image->g->SColorMap->Colors[ tr_color ].Red,
-                        image->g->SColorMap->Colors[ tr_color ].Green,
-                        image->g->SColorMap->Colors[ tr_color ].Blue,
+                        colmap->Colors[ tr_color ].Red,
+                        colmap->Colors[ tr_color ].Green,
+                        colmap->Colors[ tr_color ].Blue,
                         moy, moy, moy ) ;
 #endif
 
@@ -347,6 +985,10 @@ int store_pixels( char * filename, animated_gif * image )
 
     for ( i = 0 ; i < image->n_images ; i++ )
     {
+        /* The transparent index of a frame is in the colormap it uses */
+        colmap = image->g->SavedImages[i].ImageDesc.ColorMap ?
+            image->g->SavedImages[i].ImageDesc.ColorMap : image->g->SColorMap ;
+
         for ( j = 0 ; j < image->g->SavedImages[i].ExtensionBlockCount ; j++ )
         {
             int f ;
@@ -364,11 +1006,11 @@ int store_pixels( char * filename, animated_gif * image )
 
                     moy = 
                         (
-                         image->g->SColorMap->Colors[ tr_color ].Red
+                         colmap->Colors[ tr_color ].Red
                          +
-                         image->g->SColorMap->Colors[ tr_color ].Green
+                         colmap->Colors[ tr_color ].Green
                          +
-                         image->g->SColorMap->Colors[ tr_color ].Blue
+                         colmap->Colors[ tr_color ].Blue
                         ) / 3 ;
                     if ( moy < 0 ) moy = 0 ;
                     if ( moy > 255 ) moy = 255 ;
@@ -376,9 +1018,9 @@ int store_pixels( char * filename, animated_gif * image )
 #if SOBELF_DEBUG
                     printf( "[DEBUG] Transparency color image %d (%d,%d,%d) -> (%d,%d,%d)\n",
                             i,
-                            image->g->SColorMap->Colors[ tr_color ].Red,
-                            image->g->SColorMap->Colors[ tr_color ].Green,
-                            image->g->SColorMap->Colors[ tr_color ].Blue,
+                            colmap->Colors[ tr_color ].Red,
+                            colmap->Colors[ tr_color ].Green,
+                            colmap->Colors[ tr_color ].Blue,
                             moy, moy, moy ) ;
 #endif
 
@@ -429,6 +1071,9 @@ int store_pixels( char * filename, animated_gif * image )
                 }
             }
         }
+
+        GifFreeMapObject( image->g->SavedImages[i].ImageDesc.ColorMap ) ;
+        image->g->SavedImages[i].ImageDesc.ColorMap = NULL ;
     }
 
 #if SOBELF_DEBUG
@@ -436,57 +1081,103 @@ int store_pixels( char * filename, animated_gif * image )
             n_colors ) ;
 #endif
 
-    p = image->p ;
+    return n_colors ;
+}
 
-    /* Find the number of colors inside the image */
-    for ( i = 0 ; i < image->n_images ; i++ )
+/*
+ * Lookup table from a 24 bits color (r<<16 | g<<8 | b) to its index
+ * in a colormap plus one (0 when the color is not in the colormap).
+ * calloc maps it lazily: only the pages of the colors used are touched.
+ * It is 32 MB: allocate it once per output, not once per frame.
+ */
+#define COLOR_LUT_SIZE (1 << 24)
+#define COLOR_KEY(r,g,b) ( ((r) << 16) | ((g) << 8) | (b) )
+#define VALID_COLOR(p) ( (unsigned)((p).r | (p).g | (p).b) < 256 )
+
+unsigned short * new_color_lut( void )
+{
+    unsigned short * lut ;
+
+    lut = (unsigned short *)calloc( COLOR_LUT_SIZE, sizeof( unsigned short ) ) ;
+    if ( lut == NULL )
     {
+        fprintf( stderr, "Unable to allocate the color lookup table\n" ) ;
+    }
 
-#if SOBELF_DEBUG
-        printf( "OUTPUT: Processing image %d (total of %d images) -> %d x %d\n",
-                i, image->n_images, image->width[i], image->height[i] ) ;
-#endif
+    return lut ;
+}
+
+/* Set back to 0 the entries of the n_colors colors of colormap, the only ones used in lut */
+void clear_color_lut( unsigned short * lut, GifColorType * colormap, int n_colors )
+{
+    int k ;
+
+    for ( k = 0 ; k < n_colors ; k++ )
+    {
+        lut[ COLOR_KEY( colormap[k].Red, colormap[k].Green, colormap[k].Blue ) ] = 0 ;
+    }
+}
+
+/*
+ * Add the colors of p which are not in colormap yet, in order
+ * of first appearance. lut (see new_color_lut) must only hold
+ * colors of colormap, as the previous call on the same colormap
+ * leaves it. Returns the new number of colors, -1 if there are
+ * more than 256 colors.
+ */
+int add_pixel_colors( GifColorType * colormap, int n_colors, pixel * p, int n_pixels,
+        unsigned short * lut )
+{
+    int j, k ;
 
-        for ( j = 0 ; j < image->width[i] * image->height[i] ; j++ ) 
+    for ( k = 0 ; k < n_colors ; k++ )
+    {
+        lut[ COLOR_KEY( colormap[k].Red, colormap[k].Green, colormap[k].Blue ) ] = k + 1 ;
+    }
+
+    for ( j = 0 ; j < n_pixels ; j++ ) 
+    {
+        if ( !VALID_COLOR( p[j] ) )
         {
-            int found = 0 ;
-            for ( k = 0 ; k < n_colors ; k++ )
-            {
-                if ( p[i][j].r == colormap[k].Red &&
-                        p[i][j].g == colormap[k].Green &&
-                        p[i][j].b == colormap[k].Blue )
-                {
-                    found = 1 ;
-                }
-            }
+            fprintf( stderr,
+                    "Error: Pixel color (%d,%d,%d) out of range\n",
+                    p[j].r, p[j].g, p[j].b ) ;
+            return -1 ;
+        }
 
-            if ( found == 0 ) 
+        if ( lut[ COLOR_KEY( p[j].r, p[j].g, p[j].b ) ] == 0 ) 
+        {
+            if ( n_colors >= 256 ) 
             {
-                if ( n_colors >= 256 ) 
-                {
-                    fprintf( stderr, 
-                            "Error: Found too many colors inside the image\n"
-                           ) ;
-                    return 0 ;
-                }
+                fprintf( stderr, 
+                        "Error: Found too many colors inside the image\n"
+                       ) ;
+                return -1 ;
+            }
 
 #if SOBELF_DEBUG
-                printf( "[DEBUG] Found new %d color (%d,%d,%d)\n",
-                        n_colors, p[i][j].r, p[i][j].g, p[i][j].b ) ;
+            printf( "[DEBUG] Found new %d color (%d,%d,%d)\n",
+                    n_colors, p[j].r, p[j].g, p[j].b ) ;
 #endif
 
-                colormap[n_colors].Red = p[i][j].r ;
-                colormap[n_colors].Green = p[i][j].g ;
-                colormap[n_colors].Blue = p[i][j].b ;
-                n_colors++ ;
-            }
+            colormap[n_colors].Red = p[j].r ;
+            colormap[n_colors].Green = p[j].g ;
+            colormap[n_colors].Blue = p[j].b ;
+            n_colors++ ;
+            lut[ COLOR_KEY( p[j].r, p[j].g, p[j].b ) ] = n_colors ;
         }
     }
 
-#if SOBELF_DEBUG
-    printf( "OUTPUT: found %d color(s)\n", n_colors ) ;
-#endif
+    return n_colors ;
+}
 
+/*
+ * Round the number of colors up to a power of 2 (colormap
+ * must have 256 entries, white after the n_colors first ones).
+ */
+ColorMapObject * make_output_colormap( GifColorType * colormap, int n_colors )
+{
+    ColorMapObject * cmo ;
 
     /* Round up to a power of 2 */
     if ( n_colors != (1 << GifBitSize(n_colors) ) )
@@ -498,55 +1189,802 @@ int store_pixels( char * filename, animated_gif * image )
     printf( "OUTPUT: Rounding up to %d color(s)\n", n_colors ) ;
 #endif
 
-    /* Change the color map inside the animated gif */
-    ColorMapObject * cmo ;
-
     cmo = GifMakeMapObject( n_colors, colormap ) ;
     if ( cmo == NULL )
     {
         fprintf( stderr, "Error while creating a ColorMapObject w/ %d color(s)\n",
                 n_colors ) ;
-        return 0 ;
+        return NULL ;
     }
 
-    image->g->SColorMap = cmo ;
+    return cmo ;
+}
 
-    /* Update the raster bits according to color map */
-    for ( i = 0 ; i < image->n_images ; i++ )
+/*
+ * Lookup table of cmo (the last index if a color appears several
+ * times, like the white entries added by make_output_colormap).
+ */
+unsigned short * colormap_lut( ColorMapObject * cmo )
+{
+    unsigned short * lut ;
+    int k ;
+
+    lut = new_color_lut() ;
+    if ( lut == NULL ) { return NULL ; }
+
+    for ( k = 0 ; k < cmo->ColorCount ; k++ )
     {
-        for ( j = 0 ; j < image->width[i] * image->height[i] ; j++ ) 
-        {
-            int found_index = -1 ;
-            for ( k = 0 ; k < n_colors ; k++ ) 
-            {
-                if ( p[i][j].r == image->g->SColorMap->Colors[k].Red &&
-                        p[i][j].g == image->g->SColorMap->Colors[k].Green &&
-                        p[i][j].b == image->g->SColorMap->Colors[k].Blue )
-                {
-                    found_index = k ;
-                }
-            }
+        lut[ COLOR_KEY( cmo->Colors[k].Red, cmo->Colors[k].Green, cmo->Colors[k].Blue ) ] = k + 1 ;
+    }
 
-            if ( found_index == -1 ) 
-            {
-                fprintf( stderr,
-                        "Error: Unable to find a pixel in the color map\n" ) ;
-                return 0 ;
-            }
+    return lut ;
+}
+
+/*
+ * Fill raster with the index of each pixel of p in the colormap
+ * of lut (see colormap_lut). Returns 0 if a color is not in it.
+ */
+int map_pixels_to_colormap( unsigned short * lut, pixel * p, int n_pixels, GifByteType * raster )
+{
+    int j ;
 
-            image->g->SavedImages[i].RasterBits[j] = found_index ;
+    for ( j = 0 ; j < n_pixels ; j++ ) 
+    {
+        if ( !VALID_COLOR( p[j] ) || lut[ COLOR_KEY( p[j].r, p[j].g, p[j].b ) ] == 0 ) 
+        {
+            fprintf( stderr,
+                    "Error: Unable to find a pixel in the color map\n" ) ;
+            return 0 ;
         }
+
+        raster[j] = lut[ COLOR_KEY( p[j].r, p[j].g, p[j].b ) ] - 1 ;
     }
 
+    return 1 ;
+}
 
-    /* Write the final image */
-    if ( !output_modified_read_gif( filename, image->g ) ) { return 0 ; }
+/*
+ * Graphics control extension of an image when it has a transparent
+ * color, NULL otherwise.
+ */
+ExtensionBlock * frame_transparency( SavedImage * frame )
+{
+    int j ;
 
-    return 1 ;
+    for ( j = 0 ; j < frame->ExtensionBlockCount ; j++ )
+    {
+        if ( frame->ExtensionBlocks[j].Function == GRAPHICS_EXT_FUNC_CODE &&
+                frame->ExtensionBlocks[j].ByteCount >= 4 &&
+                ( frame->ExtensionBlocks[j].Bytes[0] & 0x01 ) )
+        {
+            return &frame->ExtensionBlocks[j] ;
+        }
+    }
+
+    return NULL ;
 }
 
+/*
+ * Smallest colormap for a frame whose raster indexes cmo: the colors
+ * used by the raster and the transparent one (if *transparent >= 0),
+ * in cmo order. raster and *transparent are remapped to it.
+ * Returns NULL (nothing changed) when it would not pay for itself:
+ * the codes only stay narrower until the LZW table outgrows the
+ * global colormap, which saves about 2^B * (B - b) bits per clear
+ * code (B, b: bits of cmo and of the local colormap), to be
+ * compared to the 3 * 2^b bytes of the local colormap.
+ */
+ColorMapObject * make_local_colormap( ColorMapObject * cmo, GifByteType * raster, int n_pixels, int * transparent )
+{
+    ColorMapObject * local ;
+    GifColorType colors[256] ;
+    GifByteType new_index[256] ;
+    int used[256] ;
+    int j, k, n_colors, n_local ;
+
+    memset( used, 0, sizeof( used ) ) ;
+    for ( j = 0 ; j < n_pixels ; j++ )
+    {
+        used[ raster[j] ] = 1 ;
+    }
+    if ( *transparent >= 0 && *transparent < cmo->ColorCount )
+    {
+        used[ *transparent ] = 1 ;
+    }
 
-int load_image_from_file(animated_gif **image , int *n_images, char *input_filename){
+    n_colors = 0 ;
+    for ( k = 0 ; k < cmo->ColorCount ; k++ )
+    {
+        if ( used[k] )
+        {
+            new_index[k] = n_colors ;
+            colors[n_colors] = cmo->Colors[k] ;
+            n_colors++ ;
+        }
+    }
+
+    int bits = GifBitSize( n_colors ) ;
+    if ( bits >= cmo->BitsPerPixel ||
+            3 * 8 * ( 1 << bits ) >= ( 1 << cmo->BitsPerPixel ) * ( cmo->BitsPerPixel - bits ) )
+    {
+        return NULL ;
+    }
+
+    /* Padded with white, like the global colormap */
+    n_local = 1 << bits ;
+    for ( k = n_colors ; k < n_local ; k++ )
+    {
+        colors[k].Red = 255 ;
+        colors[k].Green = 255 ;
+        colors[k].Blue = 255 ;
+    }
+
+    local = GifMakeMapObject( n_local, colors ) ;
+    if ( local == NULL ) { return NULL ; }
+
+    for ( j = 0 ; j < n_pixels ; j++ )
+    {
+        raster[j] = new_index[ raster[j] ] ;
+    }
+    if ( *transparent >= 0 && *transparent < cmo->ColorCount )
+    {
+        *transparent = new_index[ *transparent ] ;
+    }
+
+#if SOBELF_DEBUG
+    printf( "OUTPUT: local colormap of %d color(s) instead of %d\n",
+            n_local, cmo->ColorCount ) ;
+#endif
+
+    return local ;
+}
+
+/*
+ * Frame i of g drawn over frame i-1, their rasters mapped to cmo: only
+ * the rectangle where they differ is written (*rect), and the pixels
+ * unchanged inside it get a transparent index (*transparent, a cmo
+ * index the changes do not use, -1 if there is none). Only done when
+ * frame i-1 stays displayed as its raster says below frame i, of the
+ * same position and size: none of them is transparent nor disposed of.
+ * Returns the raster of the rectangle, NULL to write frame i as it is.
+ */
+static GifByteType * crop_unchanged( GifFileType * g, ColorMapObject * cmo, int i,
+        GifImageDesc * rect, int * transparent )
+{
+    SavedImage * prev = &g->SavedImages[i-1] ;
+    SavedImage * frame = &g->SavedImages[i] ;
+    GifImageDesc * d = &frame->ImageDesc ;
+    GraphicsControlBlock gcb ;
+    GifByteType * cropped ;
+    char used[256] = { 0 } ;
+    int left = d->Width, right = 0, top = d->Height, bottom = 0 ;
+    int n_unchanged = 0 ;
+    int x, y, k ;
+
+    if ( prev->RasterBits == NULL || frame->RasterBits == NULL ||
+            prev->ImageDesc.Left != d->Left || prev->ImageDesc.Top != d->Top ||
+            prev->ImageDesc.Width != d->Width || prev->ImageDesc.Height != d->Height ||
+            frame_transparency( prev ) != NULL || frame_transparency( frame ) != NULL )
+    {
+        return NULL ;
+    }
+    for ( k = i - 1 ; k <= i ; k++ )
+    {
+        if ( DGifSavedExtensionToGCB( g, k, &gcb ) == GIF_OK && gcb.DisposalMode > DISPOSE_DO_NOT )
+        {
+            return NULL ;
+        }
+    }
+
+    for ( y = 0 ; y < d->Height ; y++ )
+    {
+        GifByteType * a = prev->RasterBits + y * d->Width ;
+        GifByteType * b = frame->RasterBits + y * d->Width ;
+
+        if ( memcmp( a, b, d->Width ) == 0 ) { continue ; }
+
+        if ( top > y ) { top = y ; }
+        bottom = y + 1 ;
+        for ( x = 0 ; x < left && a[x] == b[x] ; x++ ) ;
+        left = x ;
+        for ( x = d->Width - 1 ; x >= right && a[x] == b[x] ; x-- ) ;
+        if ( x >= right ) { right = x + 1 ; }
+    }
+
+    /* Nothing changed: one pixel is written */
+    if ( bottom == 0 )
+    {
+        left = 0 ; right = 1 ;
+        top = 0 ; bottom = 1 ;
+    }
+
+    for ( y = top ; y < bottom ; y++ )
+    {
+        GifByteType * a = prev->RasterBits + y * d->Width ;
+        GifByteType * b = frame->RasterBits + y * d->Width ;
+
+        for ( x = left ; x < right ; x++ )
+        {
+            if ( a[x] != b[x] ) { used[ b[x] ] = 1 ; }
+            else { n_unchanged++ ; }
+        }
+    }
+
+    *transparent = -1 ;
+    for ( k = 0 ; k < cmo->ColorCount && n_unchanged > 0 && *transparent < 0 ; k++ )
+    {
+        if ( !used[k] ) { *transparent = k ; }
+    }
+
+    /* LZW likes long runs: noisy changes (e.g. video) are better written as they are */
+    if ( *transparent >= 0 )
+    {
+        int runs = 0, runs_marked = 0 ;
+        int last = -1, last_marked = -1 ;
+
+        for ( y = top ; y < bottom ; y++ )
+        {
+            GifByteType * a = prev->RasterBits + y * d->Width ;
+            GifByteType * b = frame->RasterBits + y * d->Width ;
+
+            for ( x = left ; x < right ; x++ )
+            {
+                int c = ( a[x] == b[x] ) ? *transparent : b[x] ;
+
+                runs += ( b[x] != last ) ;
+                runs_marked += ( c != last_marked ) ;
+                last = b[x] ;
+                last_marked = c ;
+            }
+        }
+        if ( runs_marked >= runs ) { *transparent = -1 ; }
+    }
+
+    if ( right - left == d->Width && bottom - top == d->Height && *transparent < 0 ) { return NULL ; }
+
+    cropped = (GifByteType *)malloc( ( right - left ) * ( bottom - top ) * sizeof( GifByteType ) ) ;
+    if ( cropped == NULL ) { return NULL ; }
+
+    for ( y = top ; y < bottom ; y++ )
+    {
+        GifByteType * a = prev->RasterBits + y * d->Width ;
+        GifByteType * b = frame->RasterBits + y * d->Width ;
+        GifByteType * c = cropped + ( y - top ) * ( right - left ) ;
+
+        for ( x = left ; x < right ; x++ )
+        {
+            c[x - left] = ( a[x] == b[x] && *transparent >= 0 ) ? *transparent : b[x] ;
+        }
+    }
+
+    *rect = *d ;
+    rect->Left += left ;
+    rect->Top += top ;
+    rect->Width = right - left ;
+    rect->Height = bottom - top ;
+
+    return cropped ;
+}
+
+/*
+ * Write the frames of image to a file. With interframe, each frame
+ * only holds what changed since the previous one (see crop_unchanged).
+ */
+int store_pixels( char * filename, animated_gif * image, int literal, int interframe )
+{
+    int n_colors = 0 ;
+    pixel ** p ;
+    int i ;
+    GifColorType * colormap ;
+
+    /* Initialize the new set of colors */
+    colormap = (GifColorType *)malloc( 256 * sizeof( GifColorType ) ) ;
+    if ( colormap == NULL ) 
+    {
+        fprintf( stderr,
+                "Unable to allocate 256 colors\n" ) ;
+        return 0 ;
+    }
+
+    /* Background and transparency colors */
+    n_colors = init_output_colormap( image, colormap ) ;
+    if ( n_colors == 0 ) { return 0 ; }
+
+    p = image->p ;
+
+    unsigned short * lut ;
+    int ok = 1 ;
+
+    /* Find the number of colors inside the image (one lookup table for every frame) */
+    lut = new_color_lut() ;
+    if ( lut == NULL ) { return 0 ; }
+    for ( i = 0 ; i < image->n_images ; i++ )
+    {
+
+#if SOBELF_DEBUG
+        printf( "OUTPUT: Processing image %d (total of %d images) -> %d x %d\n",
+                i, image->n_images, image->width[i], image->height[i] ) ;
+#endif
+
+        n_colors = add_pixel_colors( colormap, n_colors, p[i], image->width[i] * image->height[i], lut ) ;
+        if ( n_colors < 0 ) { free( lut ) ; return 0 ; }
+    }
+    free( lut ) ;
+
+#if SOBELF_DEBUG
+    printf( "OUTPUT: found %d color(s)\n", n_colors ) ;
+#endif
+
+    /* Change the color map inside the animated gif */
+    ColorMapObject * cmo ;
+
+    cmo = make_output_colormap( colormap, n_colors ) ;
+    if ( cmo == NULL ) { return 0 ; }
+
+    image->g->SColorMap = cmo ;
+
+    /* Update the raster bits according to color map */
+    for ( i = 0 ; i < image->n_images ; i++ )
+    {
+        /* Frames only scanned (see scan_pixels) have no raster bits yet */
+        if ( image->g->SavedImages[i].RasterBits == NULL )
+        {
+            image->g->SavedImages[i].RasterBits = (GifByteType *)malloc(
+                    image->width[i] * image->height[i] * sizeof( GifByteType ) ) ;
+            if ( image->g->SavedImages[i].RasterBits == NULL )
+            {
+                fprintf( stderr, "Unable to allocate the raster of image %d\n", i ) ;
+                return 0 ;
+            }
+        }
+    }
+
+    lut = colormap_lut( cmo ) ;
+    if ( lut == NULL ) { return 0 ; }
+
+    /* Frames are independent once the colormap is known */
+#pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for ( i = 0 ; i < image->n_images ; i++ )
+    {
+        if ( !map_pixels_to_colormap( lut, p[i], image->width[i] * image->height[i],
+                    image->g->SavedImages[i].RasterBits ) )
+        {
+            ok = 0 ;
+        }
+    }
+
+    free( lut ) ;
+    if ( !ok ) { return 0 ; }
+
+    /* Pixels transparent in the input stay so, with an index none of the others has */
+    if ( image->mask != NULL )
+    {
+#pragma omp parallel for schedule(dynamic)
+        for ( i = 0 ; i < image->n_images ; i++ )
+        {
+            SavedImage * frame = &image->g->SavedImages[i] ;
+            ExtensionBlock * gce = frame_transparency( frame ) ;
+            unsigned char * mask = image->mask[i] ;
+            int n_pixels = image->width[i] * image->height[i] ;
+            int count[256] = { 0 } ;
+            int transparent, j ;
+
+            if ( mask == NULL || gce == NULL ) { continue ; }
+
+            for ( j = 0 ; j < n_pixels ; j++ )
+            {
+                if ( !mask[j] ) { count[ frame->RasterBits[j] ]++ ; }
+            }
+            transparent = ( gce->Bytes[3] < cmo->ColorCount ) ? gce->Bytes[3] : 0 ;
+            for ( j = 0 ; j < cmo->ColorCount && count[transparent] ; j++ ) { transparent = j ; }
+
+            /* Every index is used: the least used color gives way to the closest other one */
+            if ( count[transparent] )
+            {
+                GifColorType * c = cmo->Colors ;
+                int closest = -1, best = 0, k ;
+
+                for ( k = 0 ; k < cmo->ColorCount ; k++ )
+                {
+                    if ( count[k] < count[transparent] ) { transparent = k ; }
+                }
+                for ( k = 0 ; k < cmo->ColorCount ; k++ )
+                {
+                    int dr = c[k].Red - c[transparent].Red ;
+                    int dg = c[k].Green - c[transparent].Green ;
+                    int db = c[k].Blue - c[transparent].Blue ;
+
+                    if ( k != transparent && ( closest < 0 || dr*dr + dg*dg + db*db < best ) )
+                    {
+                        closest = k ;
+                        best = dr*dr + dg*dg + db*db ;
+                    }
+                }
+                for ( j = 0 ; j < n_pixels ; j++ )
+                {
+                    if ( frame->RasterBits[j] == transparent ) { frame->RasterBits[j] = closest ; }
+                }
+            }
+
+            for ( j = 0 ; j < n_pixels ; j++ )
+            {
+                if ( mask[j] ) { frame->RasterBits[j] = transparent ; }
+            }
+            gce->Bytes[3] = transparent ;
+        }
+    }
+
+    /* Each frame is compared to the whole previous one, then they are cropped */
+    if ( interframe && image->n_images > 1 )
+    {
+        GifByteType ** cropped ;
+        GifImageDesc * rect ;
+        int * transparent ;
+
+        cropped = (GifByteType **)calloc( image->n_images, sizeof( GifByteType * ) ) ;
+        rect = (GifImageDesc *)malloc( image->n_images * sizeof( GifImageDesc ) ) ;
+        transparent = (int *)malloc( image->n_images * sizeof( int ) ) ;
+        if ( cropped == NULL || rect == NULL || transparent == NULL )
+        {
+            fprintf( stderr, "Unable to allocate the changes of %d images\n", image->n_images ) ;
+            return 0 ;
+        }
+
+#pragma omp parallel for schedule(dynamic)
+        for ( i = 1 ; i < image->n_images ; i++ )
+        {
+            cropped[i] = crop_unchanged( image->g, cmo, i, &rect[i], &transparent[i] ) ;
+        }
+
+        /* The graphics control extensions may be added to the file, one at a time */
+        for ( i = 1 ; i < image->n_images ; i++ )
+        {
+            SavedImage * frame = &image->g->SavedImages[i] ;
+            GraphicsControlBlock gcb ;
+
+            if ( cropped[i] == NULL ) { continue ; }
+
+            free( frame->RasterBits ) ;
+            frame->RasterBits = cropped[i] ;
+            frame->ImageDesc = rect[i] ;
+
+            DGifSavedExtensionToGCB( image->g, i, &gcb ) ;
+            gcb.DisposalMode = DISPOSE_DO_NOT ;
+            gcb.TransparentColor = transparent[i] ;
+            EGifGCBToSavedExtension( &gcb, image->g, i ) ;
+        }
+
+        free( cropped ) ;
+        free( rect ) ;
+        free( transparent ) ;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for ( i = 0 ; i < image->n_images ; i++ )
+    {
+        SavedImage * frame = &image->g->SavedImages[i] ;
+        int n_pixels = frame->ImageDesc.Width * frame->ImageDesc.Height ;
+
+        /* Frames with few colors (e.g. pure edge maps) get narrower codes */
+        ExtensionBlock * gce = frame_transparency( frame ) ;
+        int transparent = gce ? gce->Bytes[3] : -1 ;
+        frame->ImageDesc.ColorMap = make_local_colormap( cmo, frame->RasterBits, n_pixels, &transparent ) ;
+        if ( gce ) { gce->Bytes[3] = transparent ; }
+    }
+
+    /* Write the final image */
+    if ( !output_modified_read_gif( filename, image->g, literal ) ) { return 0 ; }
+
+    return 1 ;
+}
+
+
+/*
+ * Write the output when the frames were already compressed with
+ * EGifEncodeImage (encoded[i] has lengths[i] bytes for image i) using
+ * the colormap cmo, built like in store_pixels.
+ */
+int store_encoded( char * filename, animated_gif * image, ColorMapObject * cmo,
+        GifByteType ** encoded, size_t * lengths )
+{
+    image->g->SColorMap = cmo ;
+
+    return spew_encoded( filename, image->g, encoded, lengths ) ;
+}
+
+
+/*
+ * Write the output while the frames are being filtered: the colormap
+ * is settled before any frame is done, with every gray level (the
+ * filters only output grays), so the screen descriptor is written
+ * here. Then write_gif_frame writes each frame as soon as it and the
+ * ones before are done. The background and transparency colors are
+ * updated like in store_pixels. Returns NULL on error.
+ * If dup is not NULL, frames are duplicates sharing their pixels (see
+ * find_duplicate_frames) and only the frames unique[k] are given to
+ * write_gif_frame (as k): the others are written after their first copy.
+ */
+gif_writer * open_gif_writer( char * filename, animated_gif * image, int literal,
+        int * dup, int * unique )
+{
+    gif_writer * w ;
+    GifColorType * colormap ;
+    int n_colors ;
+    int error ;
+    int i, k ;
+
+    w = (gif_writer *)calloc( 1, sizeof( gif_writer ) ) ;
+    colormap = (GifColorType *)malloc( 256 * sizeof( GifColorType ) ) ;
+    if ( w == NULL || colormap == NULL ) 
+    {
+        fprintf( stderr, "Unable to allocate the writer of %s\n", filename ) ;
+        return NULL ;
+    }
+
+    /* Background and transparency colors, then the other grays */
+    n_colors = init_output_colormap( image, colormap ) ;
+    if ( n_colors == 0 ) { return NULL ; }
+
+    for ( i = 0 ; i < 256 ; i++ )
+    {
+        for ( k = 0 ; k < n_colors ; k++ )
+        {
+            if ( colormap[k].Red == i && colormap[k].Green == i && colormap[k].Blue == i ) { break ; }
+        }
+        if ( k == n_colors )
+        {
+            colormap[n_colors].Red = i ;
+            colormap[n_colors].Green = i ;
+            colormap[n_colors].Blue = i ;
+            n_colors++ ;
+        }
+        w->gray_index[i] = k ;
+    }
+
+    w->cmo = make_output_colormap( colormap, n_colors ) ;
+    free( colormap ) ;
+    if ( w->cmo == NULL ) { return NULL ; }
+
+    w->done = (char *)calloc( image->n_images, sizeof( char ) ) ;
+    if ( w->done == NULL )
+    {
+        fprintf( stderr, "Unable to allocate the writer of %s\n", filename ) ;
+        return NULL ;
+    }
+    w->image = image ;
+    w->literal = literal ;
+    w->dup = dup ;
+    w->unique = unique ;
+    w->last = NULL ;
+    if ( dup != NULL )
+    {
+        w->last = (int *)malloc( image->n_images * sizeof( int ) ) ;
+        if ( w->last == NULL )
+        {
+            fprintf( stderr, "Unable to allocate the writer of %s\n", filename ) ;
+            return NULL ;
+        }
+        for ( i = 0 ; i < image->n_images ; i++ ) { w->last[ dup[i] ] = i ; }
+    }
+    w->next = 0 ;
+    w->first = 0 ;
+
+    w->g = EGifOpenFileName( filename, false, &error ) ;
+    if ( w->g == NULL )
+    {
+        fprintf( stderr, "Error EGifOpenFileName %s\n",
+                filename ) ;
+        return NULL ;
+    }
+
+    /* Like spew_encoded: SavedImages give the GIF version and the extensions */
+    w->g->SWidth = image->g->SWidth ;
+    w->g->SHeight = image->g->SHeight ;
+    w->g->SColorResolution = image->g->SColorResolution ;
+    w->g->SBackGroundColor = image->g->SBackGroundColor ;
+    w->g->AspectByte = image->g->AspectByte ;
+    w->g->SColorMap = w->cmo ;
+    w->g->ImageCount = image->g->ImageCount ;
+    w->g->SavedImages = image->g->SavedImages ;
+    w->g->ExtensionBlockCount = image->g->ExtensionBlockCount ;
+    w->g->ExtensionBlocks = image->g->ExtensionBlocks ;
+
+    if ( EGifPutScreenDesc( w->g, w->g->SWidth, w->g->SHeight, w->g->SColorResolution,
+                w->g->SBackGroundColor, w->g->SColorMap ) == GIF_ERROR )
+    {
+        fprintf( stderr, "Error EGifPutScreenDesc %s: <%s>\n",
+                filename, GifErrorString(w->g->Error) ) ;
+        return NULL ;
+    }
+
+    return w ;
+}
+
+/*
+ * Local colormap of a frame whose transparent color (index *transparent
+ * of cmo) is white, the white pixels of raster being mapped to it: they
+ * get their own white entry after the colors used, so they are not
+ * transparent (in store_pixels, they map to the white padding of the
+ * colormap). raster and *transparent are remapped to it.
+ * Returns NULL (nothing changed) if the frame uses every color of cmo.
+ */
+static ColorMapObject * split_transparent_white( ColorMapObject * cmo, GifByteType * raster, int n_pixels, int * transparent )
+{
+    ColorMapObject * local ;
+    GifColorType colors[256] ;
+    GifByteType new_index[256] ;
+    int used[256] ;
+    int j, k, n_colors, n_local ;
+
+    memset( used, 0, sizeof( used ) ) ;
+    for ( j = 0 ; j < n_pixels ; j++ )
+    {
+        used[ raster[j] ] = 1 ;
+    }
+    used[ *transparent ] = 1 ;
+
+    n_colors = 0 ;
+    for ( k = 0 ; k < cmo->ColorCount ; k++ )
+    {
+        if ( used[k] )
+        {
+            new_index[k] = n_colors ;
+            colors[n_colors] = cmo->Colors[k] ;
+            n_colors++ ;
+        }
+    }
+    if ( n_colors >= 256 ) { return NULL ; }
+
+    /* The white of the pixels, then padding */
+    n_local = 1 << GifBitSize( n_colors + 1 ) ;
+    for ( k = n_colors ; k < n_local ; k++ )
+    {
+        colors[k].Red = 255 ;
+        colors[k].Green = 255 ;
+        colors[k].Blue = 255 ;
+    }
+
+    local = GifMakeMapObject( n_local, colors ) ;
+    if ( local == NULL ) { return NULL ; }
+
+    for ( j = 0 ; j < n_pixels ; j++ )
+    {
+        raster[j] = ( raster[j] == *transparent ) ? n_colors : new_index[ raster[j] ] ;
+    }
+    *transparent = new_index[ *transparent ] ;
+
+    return local ;
+}
+
+/* Map, compress and write frame i, then free its pixels */
+static int write_one_frame( gif_writer * w, int i )
+{
+    animated_gif * image = w->image ;
+    SavedImage * frame = &image->g->SavedImages[i] ;
+    int n_pixels = image->width[i] * image->height[i] ;
+    pixel * p = image->p[i] ;
+    GifByteType * raster ;
+    GifByteType * data ;
+    size_t length ;
+    int error ;
+    int j ;
+
+    raster = (GifByteType *)malloc( n_pixels * sizeof( GifByteType ) ) ;
+    if ( raster == NULL )
+    {
+        fprintf( stderr, "Unable to allocate the raster of image %d\n", i ) ;
+        return 0 ;
+    }
+
+    for ( j = 0 ; j < n_pixels ; j++ )
+    {
+        if ( !VALID_COLOR( p[j] ) || p[j].r != p[j].g || p[j].g != p[j].b )
+        {
+            fprintf( stderr,
+                    "Error: Pixel color (%d,%d,%d) is not a gray level\n",
+                    p[j].r, p[j].g, p[j].b ) ;
+            free( raster ) ;
+            return 0 ;
+        }
+        raster[j] = w->gray_index[ p[j].r ] ;
+    }
+
+    /* Same choice as store_pixels, but white pixels must not be transparent */
+    ExtensionBlock * gce = frame_transparency( frame ) ;
+    int transparent = gce ? gce->Bytes[3] : -1 ;
+    if ( transparent >= 0 && transparent == w->gray_index[255] )
+    {
+        frame->ImageDesc.ColorMap = split_transparent_white( w->cmo, raster, n_pixels, &transparent ) ;
+    } else
+    {
+        frame->ImageDesc.ColorMap = make_local_colormap( w->cmo, raster, n_pixels, &transparent ) ;
+    }
+    if ( gce ) { gce->Bytes[3] = transparent ; }
+
+    if ( EGifEncodeImage( frame->ImageDesc.ColorMap ? frame->ImageDesc.ColorMap : w->cmo,
+                frame->ImageDesc.Width, frame->ImageDesc.Height, frame->ImageDesc.Interlace,
+                w->literal, raster, &data, &length, &error ) == GIF_ERROR )
+    {
+        fprintf( stderr, "Error EGifEncodeImage image %d: <%s>\n",
+                i, GifErrorString(error) ) ;
+        free( raster ) ;
+        return 0 ;
+    }
+    free( raster ) ;
+
+    error = EGifPutEncodedImage( w->g, frame, data, length ) ;
+    free( data ) ;
+    if ( error == GIF_ERROR )
+    {
+        fprintf( stderr, "Error EGifPutEncodedImage image %d: <%s>\n",
+                i, GifErrorString(w->g->Error) ) ;
+        return 0 ;
+    }
+
+    GifFreeMapObject( frame->ImageDesc.ColorMap ) ;
+    frame->ImageDesc.ColorMap = NULL ;
+    free( frame->RasterBits ) ;
+    frame->RasterBits = NULL ;
+
+    /* The pixels of duplicates are freed with the last one */
+    if ( w->dup == NULL || w->last[ w->dup[i] ] == i )
+    {
+        free( image->p[i] ) ;
+    }
+    image->p[i] = NULL ;
+
+    return 1 ;
+}
+
+/*
+ * Frame i (w->first + i when the frames are given window by window)
+ * is done: write it if every frame before it is written, with the
+ * following frames already done. Otherwise it waits until they are
+ * (it is kept in image->p until then).
+ */
+int write_gif_frame( gif_writer * w, int i )
+{
+    i += w->first ;
+    w->done[ ( w->unique != NULL ) ? w->unique[i] : i ] = 1 ;
+
+    /* A duplicate is done with its first copy, written before it */
+    while ( w->next < w->image->n_images &&
+            ( w->done[ w->next ] || ( w->dup != NULL && w->dup[ w->next ] != w->next ) ) )
+    {
+        if ( !write_one_frame( w, w->next ) ) { return 0 ; }
+        w->next++ ;
+    }
+
+    return 1 ;
+}
+
+/*
+ * Write the end of the file (every frame must have been given to
+ * write_gif_frame) and free w.
+ */
+int close_gif_writer( gif_writer * w )
+{
+    if ( w->next < w->image->n_images )
+    {
+        fprintf( stderr, "Error: image %d was never written\n", w->next ) ;
+        return 0 ;
+    }
+
+    if ( EGifSpewClose( w->g ) == GIF_ERROR ) 
+    {
+        fprintf( stderr, "Error after writing g2: <%s>\n", 
+                GifErrorString(w->g->Error) ) ;
+        return 0 ;
+    }
+
+    free( w->done ) ;
+    free( w->last ) ;
+    free( w ) ;
+    return 1 ;
+}
+
+
+int load_image_from_file(animated_gif **image , int *n_images, char *input_filename){
     struct timeval t1, t2;
     gettimeofday(&t1, NULL);
     *image = load_pixels( input_filename );
@@ -587,6 +2025,18 @@ void print_how_to(rank){
         printf("USAGE: ./sobelf input_filename output_filename [-option value]\n");
         printf("OPTIONS: \n    -file : writing result in a file \n    -beta : 1 if you want to limit the number of parts, 0 if not (default 1)\n");
         printf("    -verifgif : 1 if you want to verify the result (default 0)\n");
+        printf("    -hierarchical : 1 to send whole frames to one leader per node, which splits them inside its node (default 0)\n");
+        printf("    -distdecode : 1 if every process decodes its own frames from the file, the root only scans it (default 0)\n");
+        printf("    -distencode : 1 if every process compresses the frames it filtered, the root only writes them (default 0, ignored with -hierarchical)\n");
+        printf("    -streamdecode : 1 if the root decodes the frames one after the other while the first ones are filtered (default 0, ignored with -hierarchical and -distdecode)\n");
+        printf("    -literal : 1 to store the pixels without LZW compression, much faster but bigger output (default 0)\n");
+        printf("    -dedup : 1 to filter only once the frames repeated in the animation, the copies reuse the result (default 1, ignored with -distdecode, -streamdecode and -distencode)\n");
+        printf("    -tilecache : 1 if a process filtering whole frames one after the other only filters again the tiles near the ones that changed (default 1)\n");
+        printf("    -streamwrite : 1 if the root writes each frame as soon as it and the ones before are filtered, with a palette of every gray level (default 0, ignored with -hierarchical and -distencode)\n");
+        printf("    -composite : 1 to filter the animation as it is displayed (each frame drawn over the previous ones), sets -interframe 1 (default 0, ignored with -distdecode and -streamdecode)\n");
+        printf("    -interframe : 1 to write of each frame only the rectangle where it differs from the previous one, unchanged pixels being transparent (default 0, turns off -streamwrite and -distencode)\n");
+        printf("    -transparent : 1 to keep the transparent pixels of the input transparent, the regions only made of them not being filtered (default 0, ignored with -composite, -distdecode and -streamdecode, turns off -streamwrite and -distencode)\n");
+        printf("    -memory : if not 0, MB of decoded frames the root holds at once: the frames are decoded, filtered and written window by window, sets -streamdecode 1 and -streamwrite 1 and turns off the options needing every frame (default 0)\n");
         printf("EXAMPLE:  ./sobelf input_filename output_filename -file output.txt -beta 1 -rootwork 0 -verifgif 1");
         printf("\n----------------------------------------------------------------------------------------------------------\n\n\n");
     }
@@ -1145,53 +2595,181 @@ void apply_sobel_filter_one_img_col(int width, int height, pixel *p, pixel *sobe
                     sobel[CONV_COL(j  ,k  ,height)].g = 0 ;
                     sobel[CONV_COL(j  ,k  ,height)].b = 0 ;
                 }
-            }
-        }
+            }
+        }
+
+    #pragma omp for
+        for(k=1; k<wmu; k++)
+        {
+            for(j=1; j<hmu; j++)
+            {
+                p[CONV_COL(j  ,k  ,height)].r = sobel[CONV_COL(j  ,k  ,height)].r ;
+                p[CONV_COL(j  ,k  ,height)].g = sobel[CONV_COL(j  ,k  ,height)].g ;
+                p[CONV_COL(j  ,k  ,height)].b = sobel[CONV_COL(j  ,k  ,height)].b ;
+            }
+        }
+
+}
+
+void apply_blur_filter_one_iter_col( int width, int height, pixel *p, int size, int threshold, pixel *new_, int *end )
+{
+    
+    int j, k ;
+
+    // Limits of for loops
+    int end_loop = height*0.9+size;
+    int begin_loop = height/10-size;
+    int end_last_loop = height-size;
+    int end_mid_loop = width-size;
+    int hmu = height - 1;
+    int wmu = width - 1;
+    int msize = -size;
+
+    // Copy pixels of images in ew 
+    #pragma omp for
+        for(k=0; k<wmu; k++)
+        {
+            for(j=0; j<hmu; j++)
+            {
+                new_[CONV_COL(j,k,height)].r = p[CONV_COL(j,k,height)].r ;
+                new_[CONV_COL(j,k,height)].g = p[CONV_COL(j,k,height)].g ;
+                new_[CONV_COL(j,k,height)].b = p[CONV_COL(j,k,height)].b ;
+            }
+        }
+
+        /* Apply blur on top part of image (10%) */
+    #pragma omp for
+        for(k=size; k<end_mid_loop; k++)
+        {
+            for(j=size; j<begin_loop; j++)
+            {
+                int stencil_j, stencil_k ;
+                int t_r = 0 ;
+                int t_g = 0 ;
+                int t_b = 0 ;
+
+                for ( stencil_j = -size ; stencil_j <= size ; stencil_j++ )
+                {
+                    for ( stencil_k = -size ; stencil_k <= size ; stencil_k++ )
+                    {
+                        t_r += p[CONV_COL(j+stencil_j,k+stencil_k,height)].r ;
+                        t_g += p[CONV_COL(j+stencil_j,k+stencil_k,height)].g ;
+                        t_b += p[CONV_COL(j+stencil_j,k+stencil_k,height)].b ;
+                    }
+                }
+
+                new_[CONV_COL(j,k,height)].r = t_r / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV_COL(j,k,height)].g = t_g / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV_COL(j,k,height)].b = t_b / ( (2*size+1)*(2*size+1) ) ;
+            }
+        }
+
+    
+        /* Copy the middle part of the image */
+    #pragma omp for 
+        for(k=size; k<end_mid_loop; k++)
+        {
+            for(j= begin_loop; j< end_loop; j++)
+            {
+                new_[CONV_COL(j,k,height)].r = p[CONV_COL(j,k,height)].r ; 
+                new_[CONV_COL(j,k,height)].g = p[CONV_COL(j,k,height)].g ; 
+                new_[CONV_COL(j,k,height)].b = p[CONV_COL(j,k,height)].b ; 
+            }
+        }
+
+   
+        /* Apply blur on the bottom part of the image (10%) */
+    #pragma omp for
+        for(k=size; k<end_mid_loop; k++)
+        {
+            for(j=end_loop; j<end_last_loop; j++)
+            {
+                int stencil_j, stencil_k ;
+                int t_r = 0 ;
+                int t_g = 0 ;
+                int t_b = 0 ;
+
+                for ( stencil_j = msize ; stencil_j <= size ; stencil_j++ )
+                {
+                    for ( stencil_k = -size ; stencil_k <= size ; stencil_k++ )
+                    {
+                        t_r += p[CONV_COL(j+stencil_j,k+stencil_k,height)].r ;
+                        t_g += p[CONV_COL(j+stencil_j,k+stencil_k,height)].g ;
+                        t_b += p[CONV_COL(j+stencil_j,k+stencil_k,height)].b ;
+                    }
+                }
+
+                new_[CONV_COL(j,k,height)].r = t_r / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV_COL(j,k,height)].g = t_g / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV_COL(j,k,height)].b = t_b / ( (2*size+1)*(2*size+1) ) ;
+            }
+        }
+
+   
+    #pragma omp for
+            
+        for(k=1; k<wmu; k++)
+        {
+            for(j=1; j<hmu; j++)
+            {
+                float diff_r ;
+                float diff_g ;
+                float diff_b ;
+
+                diff_r = (new_[CONV_COL(j  ,k  ,height)].r - p[CONV_COL(j  ,k  ,height)].r) ;
+                diff_g = (new_[CONV_COL(j  ,k  ,height)].g - p[CONV_COL(j  ,k  ,height)].g) ;
+                diff_b = (new_[CONV_COL(j  ,k  ,height)].b - p[CONV_COL(j  ,k  ,height)].b) ;
+
+                if ( diff_r > threshold || -diff_r > threshold 
+                        ||
+                            diff_g > threshold || -diff_g > threshold
+                            ||
+                            diff_b > threshold || -diff_b > threshold
+                    ) {
+                    *end = 0 ;
+                }
 
-    #pragma omp for
-        for(k=1; k<wmu; k++)
-        {
-            for(j=1; j<hmu; j++)
-            {
-                p[CONV_COL(j  ,k  ,height)].r = sobel[CONV_COL(j  ,k  ,height)].r ;
-                p[CONV_COL(j  ,k  ,height)].g = sobel[CONV_COL(j  ,k  ,height)].g ;
-                p[CONV_COL(j  ,k  ,height)].b = sobel[CONV_COL(j  ,k  ,height)].b ;
+                p[CONV_COL(j  ,k  ,height)].r = new_[CONV_COL(j  ,k  ,height)].r ;
+                p[CONV_COL(j  ,k  ,height)].g = new_[CONV_COL(j  ,k  ,height)].g ;
+                p[CONV_COL(j  ,k  ,height)].b = new_[CONV_COL(j  ,k  ,height)].b ;
             }
         }
-
 }
 
-void apply_blur_filter_one_iter_col( int width, int height, pixel *p, int size, int threshold, pixel *new_, int *end )
+void apply_blur_filter_one_iter_row( int width, int height, pixel *p, int size, int threshold, pixel *new_, int *end )
 {
     
     int j, k ;
 
-    // Limits of for loops
+    // Limits of for loops (same as the column version), kept inside [size, height-size) for frames of less than 50 rows
+    int end_last_loop = height-size;
     int end_loop = height*0.9+size;
     int begin_loop = height/10-size;
-    int end_last_loop = height-size;
+    if (begin_loop < size) begin_loop = size;
+    if (begin_loop > end_last_loop) begin_loop = end_last_loop;
+    if (end_loop < begin_loop) end_loop = begin_loop;
+    if (end_loop > end_last_loop) end_loop = end_last_loop;
     int end_mid_loop = width-size;
     int hmu = height - 1;
     int wmu = width - 1;
-    int msize = -size;
 
-    // Copy pixels of images in ew 
+    // Copy pixels of images in new 
     #pragma omp for
-        for(k=0; k<wmu; k++)
+        for(j=0; j<hmu; j++)
         {
-            for(j=0; j<hmu; j++)
+            for(k=0; k<wmu; k++)
             {
-                new_[CONV_COL(j,k,height)].r = p[CONV_COL(j,k,height)].r ;
-                new_[CONV_COL(j,k,height)].g = p[CONV_COL(j,k,height)].g ;
-                new_[CONV_COL(j,k,height)].b = p[CONV_COL(j,k,height)].b ;
+                new_[CONV(j,k,width)].r = p[CONV(j,k,width)].r ;
+                new_[CONV(j,k,width)].g = p[CONV(j,k,width)].g ;
+                new_[CONV(j,k,width)].b = p[CONV(j,k,width)].b ;
             }
         }
 
         /* Apply blur on top part of image (10%) */
     #pragma omp for
-        for(k=size; k<end_mid_loop; k++)
+        for(j=size; j<begin_loop; j++)
         {
-            for(j=size; j<begin_loop; j++)
+            for(k=size; k<end_mid_loop; k++)
             {
                 int stencil_j, stencil_k ;
                 int t_r = 0 ;
@@ -1202,73 +2780,69 @@ void apply_blur_filter_one_iter_col( int width, int height, pixel *p, int size,
                 {
                     for ( stencil_k = -size ; stencil_k <= size ; stencil_k++ )
                     {
-                        t_r += p[CONV_COL(j+stencil_j,k+stencil_k,height)].r ;
-                        t_g += p[CONV_COL(j+stencil_j,k+stencil_k,height)].g ;
-                        t_b += p[CONV_COL(j+stencil_j,k+stencil_k,height)].b ;
+                        t_r += p[CONV(j+stencil_j,k+stencil_k,width)].r ;
+                        t_g += p[CONV(j+stencil_j,k+stencil_k,width)].g ;
+                        t_b += p[CONV(j+stencil_j,k+stencil_k,width)].b ;
                     }
                 }
 
-                new_[CONV_COL(j,k,height)].r = t_r / ( (2*size+1)*(2*size+1) ) ;
-                new_[CONV_COL(j,k,height)].g = t_g / ( (2*size+1)*(2*size+1) ) ;
-                new_[CONV_COL(j,k,height)].b = t_b / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV(j,k,width)].r = t_r / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV(j,k,width)].g = t_g / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV(j,k,width)].b = t_b / ( (2*size+1)*(2*size+1) ) ;
             }
         }
 
-    
         /* Copy the middle part of the image */
     #pragma omp for 
-        for(k=size; k<end_mid_loop; k++)
+        for(j= begin_loop; j< end_loop; j++)
         {
-            for(j= begin_loop; j< end_loop; j++)
+            for(k=size; k<end_mid_loop; k++)
             {
-                new_[CONV_COL(j,k,height)].r = p[CONV_COL(j,k,height)].r ; 
-                new_[CONV_COL(j,k,height)].g = p[CONV_COL(j,k,height)].g ; 
-                new_[CONV_COL(j,k,height)].b = p[CONV_COL(j,k,height)].b ; 
+                new_[CONV(j,k,width)].r = p[CONV(j,k,width)].r ; 
+                new_[CONV(j,k,width)].g = p[CONV(j,k,width)].g ; 
+                new_[CONV(j,k,width)].b = p[CONV(j,k,width)].b ; 
             }
         }
 
-   
         /* Apply blur on the bottom part of the image (10%) */
     #pragma omp for
-        for(k=size; k<end_mid_loop; k++)
+        for(j=end_loop; j<end_last_loop; j++)
         {
-            for(j=end_loop; j<end_last_loop; j++)
+            for(k=size; k<end_mid_loop; k++)
             {
                 int stencil_j, stencil_k ;
                 int t_r = 0 ;
                 int t_g = 0 ;
                 int t_b = 0 ;
 
-                for ( stencil_j = msize ; stencil_j <= size ; stencil_j++ )
+                for ( stencil_j = -size ; stencil_j <= size ; stencil_j++ )
                 {
                     for ( stencil_k = -size ; stencil_k <= size ; stencil_k++ )
                     {
-                        t_r += p[CONV_COL(j+stencil_j,k+stencil_k,height)].r ;
-                        t_g += p[CONV_COL(j+stencil_j,k+stencil_k,height)].g ;
-                        t_b += p[CONV_COL(j+stencil_j,k+stencil_k,height)].b ;
+                        t_r += p[CONV(j+stencil_j,k+stencil_k,width)].r ;
+                        t_g += p[CONV(j+stencil_j,k+stencil_k,width)].g ;
+                        t_b += p[CONV(j+stencil_j,k+stencil_k,width)].b ;
                     }
                 }
 
-                new_[CONV_COL(j,k,height)].r = t_r / ( (2*size+1)*(2*size+1) ) ;
-                new_[CONV_COL(j,k,height)].g = t_g / ( (2*size+1)*(2*size+1) ) ;
-                new_[CONV_COL(j,k,height)].b = t_b / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV(j,k,width)].r = t_r / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV(j,k,width)].g = t_g / ( (2*size+1)*(2*size+1) ) ;
+                new_[CONV(j,k,width)].b = t_b / ( (2*size+1)*(2*size+1) ) ;
             }
         }
 
-   
     #pragma omp for
-            
-        for(k=1; k<wmu; k++)
+        for(j=1; j<hmu; j++)
         {
-            for(j=1; j<hmu; j++)
+            for(k=1; k<wmu; k++)
             {
                 float diff_r ;
                 float diff_g ;
                 float diff_b ;
 
-                diff_r = (new_[CONV_COL(j  ,k  ,height)].r - p[CONV_COL(j  ,k  ,height)].r) ;
-                diff_g = (new_[CONV_COL(j  ,k  ,height)].g - p[CONV_COL(j  ,k  ,height)].g) ;
-                diff_b = (new_[CONV_COL(j  ,k  ,height)].b - p[CONV_COL(j  ,k  ,height)].b) ;
+                diff_r = (new_[CONV(j  ,k  ,width)].r - p[CONV(j  ,k  ,width)].r) ;
+                diff_g = (new_[CONV(j  ,k  ,width)].g - p[CONV(j  ,k  ,width)].g) ;
+                diff_b = (new_[CONV(j  ,k  ,width)].b - p[CONV(j  ,k  ,width)].b) ;
 
                 if ( diff_r > threshold || -diff_r > threshold 
                         ||
@@ -1279,9 +2853,585 @@ void apply_blur_filter_one_iter_col( int width, int height, pixel *p, int size,
                     *end = 0 ;
                 }
 
-                p[CONV_COL(j  ,k  ,height)].r = new_[CONV_COL(j  ,k  ,height)].r ;
-                p[CONV_COL(j  ,k  ,height)].g = new_[CONV_COL(j  ,k  ,height)].g ;
-                p[CONV_COL(j  ,k  ,height)].b = new_[CONV_COL(j  ,k  ,height)].b ;
+                p[CONV(j  ,k  ,width)].r = new_[CONV(j  ,k  ,width)].r ;
+                p[CONV(j  ,k  ,width)].g = new_[CONV(j  ,k  ,width)].g ;
+                p[CONV(j  ,k  ,width)].b = new_[CONV(j  ,k  ,width)].b ;
+            }
+        }
+}
+
+void apply_sobel_filter_one_img_row(int width, int height, pixel *p, pixel *sobel)
+{
+    int j, k ;
+    int hmu = height - 1;
+    int wmu = width - 1;
+
+    #pragma omp for
+        for(j=1; j<hmu; j++)
+        {
+            for(k=1; k<wmu; k++)
+            {
+                int pixel_blue_no, pixel_blue_n, pixel_blue_ne;
+                int pixel_blue_so, pixel_blue_s, pixel_blue_se;
+                int pixel_blue_o , pixel_blue_e ;
+
+                float deltaX_blue ;
+                float deltaY_blue ;
+                float val_blue;
+
+                pixel_blue_no = p[CONV(j-1,k-1,width)].b ;
+                pixel_blue_n  = p[CONV(j-1,k  ,width)].b ;
+                pixel_blue_ne = p[CONV(j-1,k+1,width)].b ;
+                pixel_blue_so = p[CONV(j+1,k-1,width)].b ;
+                pixel_blue_s  = p[CONV(j+1,k  ,width)].b ;
+                pixel_blue_se = p[CONV(j+1,k+1,width)].b ;
+                pixel_blue_o  = p[CONV(j  ,k-1,width)].b ;
+                pixel_blue_e  = p[CONV(j  ,k+1,width)].b ;
+
+                deltaX_blue = -pixel_blue_no + pixel_blue_ne - 2*pixel_blue_o + 2*pixel_blue_e - pixel_blue_so + pixel_blue_se;             
+                deltaY_blue = pixel_blue_se + 2*pixel_blue_s + pixel_blue_so - pixel_blue_ne - 2*pixel_blue_n - pixel_blue_no;
+
+                val_blue = sqrt(deltaX_blue * deltaX_blue + deltaY_blue * deltaY_blue)/4;
+
+                if ( val_blue > 50 ) 
+                {
+                    sobel[CONV(j  ,k  ,width)].r = 255 ;
+                    sobel[CONV(j  ,k  ,width)].g = 255 ;
+                    sobel[CONV(j  ,k  ,width)].b = 255 ;
+                } else
+                {
+                    sobel[CONV(j  ,k  ,width)].r = 0 ;
+                    sobel[CONV(j  ,k  ,width)].g = 0 ;
+                    sobel[CONV(j  ,k  ,width)].b = 0 ;
+                }
+            }
+        }
+
+    #pragma omp for
+        for(j=1; j<hmu; j++)
+        {
+            for(k=1; k<wmu; k++)
+            {
+                p[CONV(j  ,k  ,width)].r = sobel[CONV(j  ,k  ,width)].r ;
+                p[CONV(j  ,k  ,width)].g = sobel[CONV(j  ,k  ,width)].g ;
+                p[CONV(j  ,k  ,width)].b = sobel[CONV(j  ,k  ,width)].b ;
+            }
+        }
+}
+
+// WHOLE FRAMES, IN PLACE AND WITHOUT MPI
+
+void apply_filters_one_frame(int width, int height, pixel *p, int size, int threshold)
+{
+    int end = 1;
+
+    // Used in functions to store (cannot be declared in omp parallel)
+    pixel *interm = (pixel *)malloc(width * height * sizeof( pixel ) );
+
+    #pragma omp parallel default(none) shared(width, height, p, size, threshold, interm, end)
+    {
+        apply_gray_filter_one_img(width, height, p);
+        do{
+            #pragma omp barrier
+            #pragma omp single
+            end = 1;
+
+            apply_blur_filter_one_iter_row(width, height, p, size, threshold, interm, &end);
+            #pragma omp barrier
+        } while( !end );
+        apply_sobel_filter_one_img_row(width, height, p, interm);
+    }
+
+    free(interm);
+}
+
+// WHOLE FRAMES, ONLY WHERE THEY CHANGED SINCE THE PREVIOUS ONE
+
+/*
+ * Same filters as apply_filters_one_frame, on the pixels of the tiles
+ * (FILTER_TILE x FILTER_TILE squares) set in a mask. The blur iterations
+ * record the tiles with a pixel not converged yet instead of a single
+ * end flag. Pixels are computed exactly like in the functions above.
+ */
+#define FILTER_TILE 32
+
+typedef struct tile_grid
+{
+    int width, height ; // of the frame
+    int n_tj, n_tk ; // number of rows and columns of tiles
+} tile_grid ;
+
+static void gray_tiles(tile_grid *t, pixel *p, unsigned char *mask)
+{
+    int tj ;
+
+    #pragma omp parallel for schedule(dynamic)
+        for(tj=0; tj<t->n_tj; tj++)
+        {
+            int tk, j, k ;
+            for(tk=0; tk<t->n_tk; tk++)
+            {
+                if(!mask[tj*t->n_tk+tk])
+                    continue ;
+                for(j=tj*FILTER_TILE; j<(tj+1)*FILTER_TILE && j<t->height; j++)
+                    for(k=tk*FILTER_TILE; k<(tk+1)*FILTER_TILE && k<t->width; k++)
+                    {
+                        int moy = (p[CONV(j,k,t->width)].r + p[CONV(j,k,t->width)].g + p[CONV(j,k,t->width)].b)/3 ;
+                        if ( moy < 0 ) moy = 0 ;
+                        if ( moy > 255 ) moy = 255 ;
+                        p[CONV(j,k,t->width)].r = moy ;
+                        p[CONV(j,k,t->width)].g = moy ;
+                        p[CONV(j,k,t->width)].b = moy ;
+                    }
+            }
+        }
+}
+
+// One iteration of apply_blur_filter_one_iter_row; active[tile] is set if a pixel of the tile is not converged,
+// modified[tile] (if not NULL) if a pixel of the tile changed at all
+static void blur_tiles(tile_grid *t, pixel *p, int size, int threshold, pixel *new_, unsigned char *mask, unsigned char *active, unsigned char *modified)
+{
+    int width = t->width, height = t->height ;
+    int end_loop = height*0.9+size;
+    int begin_loop = height/10-size;
+    int end_last_loop = height-size;
+    int end_mid_loop = width-size;
+    int hmu = height - 1;
+    int wmu = width - 1;
+    int tj ;
+
+    #pragma omp parallel for schedule(dynamic)
+        for(tj=0; tj<t->n_tj; tj++)
+        {
+            int tk, j, k ;
+            for(tk=0; tk<t->n_tk; tk++)
+            {
+                if(!mask[tj*t->n_tk+tk])
+                    continue ;
+                for(j=tj*FILTER_TILE; j<(tj+1)*FILTER_TILE && j<hmu; j++)
+                    for(k=tk*FILTER_TILE; k<(tk+1)*FILTER_TILE && k<wmu; k++)
+                    {
+                        // Top and bottom parts of the image (10%) are blurred, the rest is copied
+                        if( ( (j>=size && j<begin_loop) || (j>=end_loop && j<end_last_loop) ) && k>=size && k<end_mid_loop )
+                        {
+                            int stencil_j, stencil_k ;
+                            int t_r = 0 ;
+                            int t_g = 0 ;
+                            int t_b = 0 ;
+
+                            for ( stencil_j = -size ; stencil_j <= size ; stencil_j++ )
+                            {
+                                for ( stencil_k = -size ; stencil_k <= size ; stencil_k++ )
+                                {
+                                    t_r += p[CONV(j+stencil_j,k+stencil_k,width)].r ;
+                                    t_g += p[CONV(j+stencil_j,k+stencil_k,width)].g ;
+                                    t_b += p[CONV(j+stencil_j,k+stencil_k,width)].b ;
+                                }
+                            }
+
+                            new_[CONV(j,k,width)].r = t_r / ( (2*size+1)*(2*size+1) ) ;
+                            new_[CONV(j,k,width)].g = t_g / ( (2*size+1)*(2*size+1) ) ;
+                            new_[CONV(j,k,width)].b = t_b / ( (2*size+1)*(2*size+1) ) ;
+                        } else
+                        {
+                            new_[CONV(j,k,width)] = p[CONV(j,k,width)] ;
+                        }
+                    }
+            }
+        }
+
+    #pragma omp parallel for schedule(dynamic)
+        for(tj=0; tj<t->n_tj; tj++)
+        {
+            int tk, j, k ;
+            for(tk=0; tk<t->n_tk; tk++)
+            {
+                if(!mask[tj*t->n_tk+tk])
+                    continue ;
+                active[tj*t->n_tk+tk] = 0 ;
+                if(modified != NULL)
+                    modified[tj*t->n_tk+tk] = 0 ;
+                for(j=tj*FILTER_TILE; j<(tj+1)*FILTER_TILE && j<hmu; j++)
+                    for(k=tk*FILTER_TILE; k<(tk+1)*FILTER_TILE && k<wmu; k++)
+                    {
+                        float diff_r ;
+                        float diff_g ;
+                        float diff_b ;
+
+                        if( j < 1 || k < 1 )
+                            continue ;
+
+                        diff_r = (new_[CONV(j  ,k  ,width)].r - p[CONV(j  ,k  ,width)].r) ;
+                        diff_g = (new_[CONV(j  ,k  ,width)].g - p[CONV(j  ,k  ,width)].g) ;
+                        diff_b = (new_[CONV(j  ,k  ,width)].b - p[CONV(j  ,k  ,width)].b) ;
+
+                        if ( diff_r > threshold || -diff_r > threshold 
+                                ||
+                                    diff_g > threshold || -diff_g > threshold
+                                    ||
+                                    diff_b > threshold || -diff_b > threshold
+                            ) {
+                            active[tj*t->n_tk+tk] = 1 ;
+                        }
+                        if(modified != NULL && memcmp(&new_[CONV(j,k,width)], &p[CONV(j,k,width)], sizeof(pixel)) != 0)
+                            modified[tj*t->n_tk+tk] = 1 ;
+
+                        p[CONV(j  ,k  ,width)] = new_[CONV(j  ,k  ,width)] ;
+                    }
+            }
+        }
+}
+
+static void sobel_tiles(tile_grid *t, pixel *p, pixel *sobel, unsigned char *mask)
+{
+    int width = t->width ;
+    int hmu = t->height - 1;
+    int wmu = t->width - 1;
+    int tj ;
+
+    #pragma omp parallel for schedule(dynamic)
+        for(tj=0; tj<t->n_tj; tj++)
+        {
+            int tk, j, k ;
+            for(tk=0; tk<t->n_tk; tk++)
+            {
+                if(!mask[tj*t->n_tk+tk])
+                    continue ;
+                for(j=tj*FILTER_TILE; j<(tj+1)*FILTER_TILE && j<hmu; j++)
+                    for(k=tk*FILTER_TILE; k<(tk+1)*FILTER_TILE && k<wmu; k++)
+                    {
+                        int pixel_blue_no, pixel_blue_n, pixel_blue_ne;
+                        int pixel_blue_so, pixel_blue_s, pixel_blue_se;
+                        int pixel_blue_o , pixel_blue_e ;
+
+                        float deltaX_blue ;
+                        float deltaY_blue ;
+                        float val_blue;
+
+                        if( j < 1 || k < 1 )
+                            continue ;
+
+                        pixel_blue_no = p[CONV(j-1,k-1,width)].b ;
+                        pixel_blue_n  = p[CONV(j-1,k  ,width)].b ;
+                        pixel_blue_ne = p[CONV(j-1,k+1,width)].b ;
+                        pixel_blue_so = p[CONV(j+1,k-1,width)].b ;
+                        pixel_blue_s  = p[CONV(j+1,k  ,width)].b ;
+                        pixel_blue_se = p[CONV(j+1,k+1,width)].b ;
+                        pixel_blue_o  = p[CONV(j  ,k-1,width)].b ;
+                        pixel_blue_e  = p[CONV(j  ,k+1,width)].b ;
+
+                        deltaX_blue = -pixel_blue_no + pixel_blue_ne - 2*pixel_blue_o + 2*pixel_blue_e - pixel_blue_so + pixel_blue_se;             
+                        deltaY_blue = pixel_blue_se + 2*pixel_blue_s + pixel_blue_so - pixel_blue_ne - 2*pixel_blue_n - pixel_blue_no;
+
+                        val_blue = sqrt(deltaX_blue * deltaX_blue + deltaY_blue * deltaY_blue)/4;
+
+                        sobel[CONV(j  ,k  ,width)].r = ( val_blue > 50 ) ? 255 : 0 ;
+                        sobel[CONV(j  ,k  ,width)].g = sobel[CONV(j  ,k  ,width)].r ;
+                        sobel[CONV(j  ,k  ,width)].b = sobel[CONV(j  ,k  ,width)].r ;
+                    }
+            }
+        }
+
+    #pragma omp parallel for schedule(dynamic)
+        for(tj=0; tj<t->n_tj; tj++)
+        {
+            int tk, j, k ;
+            for(tk=0; tk<t->n_tk; tk++)
+            {
+                if(!mask[tj*t->n_tk+tk])
+                    continue ;
+                for(j=(tj*FILTER_TILE > 1 ? tj*FILTER_TILE : 1); j<(tj+1)*FILTER_TILE && j<hmu; j++)
+                    for(k=(tk*FILTER_TILE > 1 ? tk*FILTER_TILE : 1); k<(tk+1)*FILTER_TILE && k<wmu; k++)
+                        p[CONV(j,k,width)] = sobel[CONV(j,k,width)] ;
+            }
+        }
+}
+
+// Copy the pixels of the tiles set (or not set if inverse) in mask from src to dst
+static void copy_tiles(tile_grid *t, pixel *src, pixel *dst, unsigned char *mask, int inverse)
+{
+    int tj ;
+
+    #pragma omp parallel for schedule(dynamic)
+        for(tj=0; tj<t->n_tj; tj++)
+        {
+            int tk, j ;
+            for(tk=0; tk<t->n_tk; tk++)
+            {
+                int k0 = tk*FILTER_TILE ;
+                int n = (k0 + FILTER_TILE < t->width) ? FILTER_TILE : t->width - k0 ;
+                if(!mask[tj*t->n_tk+tk] == !inverse)
+                    continue ;
+                for(j=tj*FILTER_TILE; j<(tj+1)*FILTER_TILE && j<t->height; j++)
+                    memcpy(&dst[CONV(j,k0,t->width)], &src[CONV(j,k0,t->width)], n * sizeof(pixel)) ;
+            }
+        }
+}
+
+// dst: the tiles of src and the ones at most r tiles away
+static int dilate_tiles(tile_grid *t, unsigned char *src, unsigned char *dst, int r)
+{
+    int tj, tk, dj, dk, n = 0 ;
+
+    memset(dst, 0, t->n_tj * t->n_tk) ;
+    for(tj=0; tj<t->n_tj; tj++)
+        for(tk=0; tk<t->n_tk; tk++)
+        {
+            if(!src[tj*t->n_tk+tk])
+                continue ;
+            for(dj=tj-r; dj<=tj+r; dj++)
+                for(dk=tk-r; dk<=tk+r; dk++)
+                    if(dj>=0 && dj<t->n_tj && dk>=0 && dk<t->n_tk)
+                        dst[dj*t->n_tk+dk] = 1 ;
+        }
+    for(tj=0; tj<t->n_tj*t->n_tk; tj++)
+        n += dst[tj] ;
+    return n ;
+}
+
+// Tiles with a pixel not transparent
+static void opaque_tiles(tile_grid *t, unsigned char *transparent, unsigned char *opaque)
+{
+    int tj ;
+
+    #pragma omp parallel for schedule(dynamic)
+        for(tj=0; tj<t->n_tj; tj++)
+        {
+            int tk, j, k ;
+            for(tk=0; tk<t->n_tk; tk++)
+            {
+                opaque[tj*t->n_tk+tk] = 0 ;
+                for(j=tj*FILTER_TILE; j<(tj+1)*FILTER_TILE && j<t->height; j++)
+                    for(k=tk*FILTER_TILE; k<(tk+1)*FILTER_TILE && k<t->width; k++)
+                        if(!transparent[CONV(j,k,t->width)])
+                            opaque[tj*t->n_tk+tk] = 1 ;
+            }
+        }
+}
+
+/*
+ * Everything, recording the tiles not converged at each iteration in the cache.
+ * With the transparent pixels (if not NULL), the blur skips the tiles whose
+ * stencil only reads pixels that did not change at the previous iteration:
+ * they would not change either. At first these are the tiles with only
+ * transparent pixels around them, all of one color (the transparent one).
+ */
+static void filter_all_tiles(tile_grid *t, pixel *p, int size, int threshold, pixel *interm, filter_cache *cache, unsigned char *transparent)
+{
+    int n_tiles = t->n_tj * t->n_tk ;
+    int r = (size + FILTER_TILE - 1) / FILTER_TILE ;
+    unsigned char *all = (unsigned char *)malloc(n_tiles) ;
+    unsigned char *blur = all, *modified = NULL ;
+    int i, end ;
+
+    memset(all, 1, n_tiles) ;
+    gray_tiles(t, p, all) ;
+    if(transparent != NULL)
+    {
+        blur = (unsigned char *)malloc(n_tiles) ;
+        modified = (unsigned char *)malloc(n_tiles) ;
+        opaque_tiles(t, transparent, modified) ;
+        dilate_tiles(t, modified, blur, r) ;
+    }
+    cache->n_iter = 0 ;
+    do{
+        if(cache->n_iter == cache->max_iter)
+        {
+            cache->max_iter = cache->max_iter ? 2 * cache->max_iter : 8 ;
+            cache->active = (unsigned char *)realloc(cache->active, cache->max_iter * n_tiles) ;
+        }
+        if(modified != NULL)
+        {
+            memset(cache->active + cache->n_iter * n_tiles, 0, n_tiles) ;
+            memset(modified, 0, n_tiles) ;
+        }
+        blur_tiles(t, p, size, threshold, interm, blur, cache->active + cache->n_iter * n_tiles, modified) ;
+        if(modified != NULL)
+            dilate_tiles(t, modified, blur, r) ;
+        end = 1 ;
+        for(i=0; i<n_tiles; i++)
+            if(cache->active[cache->n_iter * n_tiles + i])
+                end = 0 ;
+        cache->n_iter++ ;
+    } while( !end );
+    sobel_tiles(t, p, interm, all) ;
+    if(blur != all)
+        free(blur) ;
+    free(modified) ;
+    free(all) ;
+}
+
+void init_filter_cache(filter_cache *cache)
+{
+    memset(cache, 0, sizeof(filter_cache)) ;
+}
+
+void free_filter_cache(filter_cache *cache)
+{
+    free(cache->input) ;
+    free(cache->output) ;
+    free(cache->active) ;
+    init_filter_cache(cache) ;
+}
+
+/*
+ * Same result as apply_filters_one_frame, but when the frame has the
+ * size of the previous one given with the same cache, only the tiles
+ * near the ones whose input changed are filtered again, the others
+ * are copied from the previous result.
+ * A pixel only depends on the input at most n_iter * size + 1 pixels
+ * away (n_iter blur iterations, then the sobel stencil), so the tiles
+ * changed are grown by that much (the area filtered twice as much, for
+ * the pixels near its border to be right). The number of iterations
+ * depends on the whole frame: the tiles not filtered again are assumed
+ * to converge at the same iterations as in the previous frame, and the
+ * frame is filtered again entirely when it does not stop after the
+ * same number of iterations. The transparent pixels (NULL if none) are
+ * used as in apply_filters_one_frame_transparent when it is.
+ */
+void apply_filters_one_frame_cached(int width, int height, pixel *p, int size, int threshold, filter_cache *cache, unsigned char *transparent)
+{
+    tile_grid t ;
+    int n_tiles, n_changed, r, i, tj, tk, j ;
+    unsigned char *changed, *area, *window, *active ;
+    pixel *interm ;
+
+    t.width = width ;
+    t.height = height ;
+    t.n_tj = (height + FILTER_TILE - 1) / FILTER_TILE ;
+    t.n_tk = (width + FILTER_TILE - 1) / FILTER_TILE ;
+    n_tiles = t.n_tj * t.n_tk ;
+    interm = (pixel *)malloc(width * height * sizeof( pixel ) ) ;
+
+    // A new size: everything is filtered and kept for the next frame
+    if(cache->input == NULL || cache->width != width || cache->height != height)
+    {
+        free_filter_cache(cache) ;
+        cache->width = width ;
+        cache->height = height ;
+        cache->input = (pixel *)malloc(width * height * sizeof( pixel ) ) ;
+        cache->output = (pixel *)malloc(width * height * sizeof( pixel ) ) ;
+        memcpy(cache->input, p, width * height * sizeof( pixel ) ) ;
+        filter_all_tiles(&t, p, size, threshold, interm, cache, transparent) ;
+        memcpy(cache->output, p, width * height * sizeof( pixel ) ) ;
+        free(interm) ;
+        return ;
+    }
+
+    // Tiles whose input changed
+    changed = (unsigned char *)calloc(n_tiles, 1) ;
+    area = (unsigned char *)malloc(n_tiles) ;
+    window = (unsigned char *)malloc(n_tiles) ;
+    active = (unsigned char *)malloc(n_tiles) ;
+    #pragma omp parallel for private(tk, j)
+        for(tj=0; tj<t.n_tj; tj++)
+            for(tk=0; tk<t.n_tk; tk++)
+            {
+                int k0 = tk*FILTER_TILE ;
+                int n = (k0 + FILTER_TILE < width) ? FILTER_TILE : width - k0 ;
+                for(j=tj*FILTER_TILE; j<(tj+1)*FILTER_TILE && j<height; j++)
+                    if(memcmp(&p[CONV(j,k0,width)], &cache->input[CONV(j,k0,width)], n * sizeof(pixel)) != 0)
+                    {
+                        changed[tj*t.n_tk+tk] = 1 ;
+                        break ;
+                    }
+            }
+    n_changed = 0 ;
+    for(i=0; i<n_tiles; i++)
+        n_changed += changed[i] ;
+    copy_tiles(&t, p, cache->input, changed, 0) ;
+
+    // Tiles whose result may change, and the ones filtered to get them right
+    r = (cache->n_iter * size + 1 + FILTER_TILE - 1) / FILTER_TILE ;
+    dilate_tiles(&t, changed, area, r) ;
+    if(dilate_tiles(&t, area, window, r) * 4 > n_tiles * 3)
+        goto filter_all ;
+
+    if(n_changed > 0)
+    {
+        gray_tiles(&t, p, window) ;
+        for(i=0; i<cache->n_iter; i++)
+        {
+            unsigned char *previous = cache->active + i * n_tiles ;
+            int end = 1, k ;
+
+            blur_tiles(&t, p, size, threshold, interm, window, active, NULL) ;
+            for(k=0; k<n_tiles; k++)
+            {
+                if(area[k])
+                    previous[k] = active[k] ;
+                if(previous[k])
+                    end = 0 ;
+            }
+
+            // Not the same number of iterations as the previous frame
+            if(end != (i == cache->n_iter - 1))
+            {
+                memcpy(p, cache->input, width * height * sizeof( pixel ) ) ;
+                goto filter_all ;
             }
         }
-}
\ No newline at end of file
+        sobel_tiles(&t, p, interm, area) ;
+    }
+    copy_tiles(&t, cache->output, p, area, 1) ;
+    copy_tiles(&t, p, cache->output, area, 0) ;
+
+    free(changed) ;
+    free(area) ;
+    free(window) ;
+    free(active) ;
+    free(interm) ;
+    return ;
+
+filter_all:
+    filter_all_tiles(&t, p, size, threshold, interm, cache, transparent) ;
+    memcpy(cache->output, p, width * height * sizeof( pixel ) ) ;
+    free(changed) ;
+    free(area) ;
+    free(window) ;
+    free(active) ;
+    free(interm) ;
+}
+
+/*
+ * Same result as apply_filters_one_frame, where transparent[j] is set for
+ * the transparent pixels of the frame: the tiles with only transparent
+ * pixels around them are not blurred (see filter_all_tiles).
+ */
+void apply_filters_one_frame_transparent(int width, int height, pixel *p, int size, int threshold, unsigned char *transparent)
+{
+    tile_grid t ;
+    filter_cache cache ;
+    pixel *interm ;
+
+    t.width = width ;
+    t.height = height ;
+    t.n_tj = (height + FILTER_TILE - 1) / FILTER_TILE ;
+    t.n_tk = (width + FILTER_TILE - 1) / FILTER_TILE ;
+    interm = (pixel *)malloc(width * height * sizeof( pixel ) ) ;
+
+    init_filter_cache(&cache) ;
+    filter_all_tiles(&t, p, size, threshold, interm, &cache, transparent) ;
+    free_filter_cache(&cache) ;
+    free(interm) ;
+}
+
+void copy_rows_to_columns(pixel *src, int src_width, int n_columns, int height, pixel *dst)
+{
+    int j, k ;
+
+    #pragma omp parallel for private(j)
+        for(k=0; k<n_columns; k++)
+            for(j=0; j<height; j++)
+                dst[CONV_COL(j,k,height)] = src[CONV(j,k,src_width)] ;
+}
+
+void copy_columns_to_rows(pixel *src, int n_columns, int height, pixel *dst, int dst_width)
+{
+    int j, k ;
+
+    #pragma omp parallel for private(k)
+        for(j=0; j<height; j++)
+            for(k=0; k<n_columns; k++)
+                dst[CONV(j,k,dst_width)] = src[CONV_COL(j,k,height)] ;
+}